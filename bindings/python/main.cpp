@@ -557,6 +557,15 @@ exception_message<mm::unknown_groupset_error>(const mm::unknown_groupset_error &
 	return oss.str();
 }
 
+template <>
+std::string
+exception_message<mm::unknown_groupset_type_error>(
+		const mm::unknown_groupset_type_error &ex) {
+	std::ostringstream oss;
+	oss << ex.what() << ": groupset_type=" << ex.groupset_type();
+	return oss.str();
+}
+
 } // namespace detail
 
 template <typename Ex>
@@ -618,6 +627,9 @@ init_exception_translator() {
 	exception::register_exception_translator<mm::remotes_empty_error>(
 			"RemotesEmptyError", mastermind_cache_error);
 
+	exception::register_exception_translator<mm::unknown_groupset_type_error>(
+			"UnknownGroupsetTypeError", mastermind_cache_error);
+
 }
 
 } // namespace binding
@@ -20,6 +20,7 @@
 #ifndef LIBMASTERMIND__INCLUDE__LIBMASTERMIND__COMMON__HPP
 #define LIBMASTERMIND__INCLUDE__LIBMASTERMIND__COMMON__HPP
 
+#include <cstddef>
 #include <vector>
 
 namespace mastermind {
@@ -27,6 +28,55 @@ namespace mastermind {
 typedef int group_t;
 typedef std::vector<int> groups_t;
 
+// Read-only view of contiguous elements owned by someone else, views returned
+// by a namespace state are valid while the state is alive
+template <typename T>
+class span_t {
+public:
+	typedef T value_type;
+	typedef const T &const_reference;
+	typedef const T *const_iterator;
+
+	span_t()
+		: first(0)
+		, count(0)
+	{}
+
+	span_t(const T *first_, size_t count_)
+		: first(first_)
+		, count(count_)
+	{}
+
+	const_iterator
+	begin() const {
+		return first;
+	}
+
+	const_iterator
+	end() const {
+		return first + count;
+	}
+
+	size_t
+	size() const {
+		return count;
+	}
+
+	bool
+	empty() const {
+		return count == 0;
+	}
+
+	const_reference
+	operator [] (size_t index) const {
+		return first[index];
+	}
+
+private:
+	const T *first;
+	size_t count;
+};
+
 } // namespace mastermind
 
 #endif /* LIBMASTERMIND__INCLUDE__LIBMASTERMIND__COMMON__HPP */
@@ -97,6 +97,7 @@ enum class mastermind_errc {
 	, unknown_group
 	, unknown_groupset
 	, remotes_empty
+	, unknown_groupset_type
 };
 
 const std::error_category &
@@ -203,6 +204,19 @@ public:
 	remotes_empty_error();
 };
 
+class unknown_groupset_type_error : public mastermind_error
+{
+public:
+	unknown_groupset_type_error(std::string groupset_type_);
+	~unknown_groupset_type_error() noexcept {}
+
+	const std::string &
+	groupset_type() const;
+
+private:
+	std::string m_groupset_type;
+};
+
 } // namespace mastermind
 
 #endif /* INCLUDE__LIBMASTERMIND__ERROR_H */
@@ -23,6 +23,7 @@
 #include <libmastermind/common.hpp>
 #include <libmastermind/error.hpp>
 #include <libmastermind/couple_sequence.hpp>
+#include <libmastermind/random.hpp>
 
 #include <cocaine/framework/logging.hpp>
 
@@ -31,6 +32,7 @@
 
 #include <boost/optional.hpp>
 
+#include <chrono>
 #include <map>
 #include <string>
 #include <vector>
@@ -92,6 +94,31 @@ public:
 	std::function<user_settings_ptr_t (const std::string &name, const kora::config_t &config)>
 	user_settings_factory_t;
 
+	struct couple_space_t {
+		// The lowest group of the couple, it is accepted by couples_t methods
+		group_t couple_id;
+		uint64_t free_effective_space;
+	};
+
+	// Where the client runs, empty fields are not taken into account
+	struct locality_t {
+		std::string dc;
+		std::string host;
+	};
+
+	// Id of a string interned by a namespace state, it means nothing in other states
+	typedef uint32_t string_id_t;
+
+	// A host of a group parsed from the snapshot, missing fields are empty or zero
+	struct host_t {
+		// The group is -1 if mastermind did not tell it
+		group_t group;
+		std::string host;
+		uint16_t port;
+		int family;
+		std::string dc;
+	};
+
 	class settings_t {
 	public:
 		size_t groups_count() const;
@@ -108,6 +135,7 @@ public:
 	};
 
 	class couples_t;
+	class weights_t;
 
 	class groupset_t {
 	public:
@@ -122,8 +150,11 @@ public:
 		const kora::dynamic_t &hosts() const;
 		const kora::dynamic_t &settings() const;
 
+		span_t<host_t> host_list() const;
+
 	private:
 		friend class couples_t;
+		friend class weights_t;
 
 		struct data_t;
 		groupset_t(const data_t &data_);
@@ -138,12 +169,31 @@ public:
 
 		std::vector<std::string> get_couple_groupset_ids(group_t group) const;
 
+		// Views hold ids of strings which get_string resolves
+		span_t<string_id_t> get_couple_read_preference_view(group_t group) const;
+		span_t<string_id_t> get_couple_groupset_ids_view(group_t group) const;
+		const std::string &get_string(string_id_t id) const;
+
 		groups_t get_couple_groups(group_t group) const;
 		groups_t get_groups(group_t group) const;
 
+		// Groups on the local host first, then groups in the local dc
+		groups_t get_couple_read_groups(group_t group) const;
+
+		span_t<group_t> get_couple_groups_view(group_t group) const;
+		span_t<group_t> get_couple_read_groups_view(group_t group) const;
+		void get_groups(group_t group, groups_t &result) const;
+
 		uint64_t free_effective_space(group_t group) const;
 		uint64_t free_reserved_space(group_t group) const;
+
+		// Couples in descending order of free effective space in the snapshot
+		span_t<couple_space_t> get_couples_by_free_space(size_t count) const;
+		span_t<couple_space_t> get_couples_with_free_space(uint64_t free_space) const;
+
 		kora::dynamic_t hosts(group_t group) const;
+
+		span_t<host_t> get_couple_hosts(group_t group) const;
 	private:
 		friend class namespace_state_t;
 
@@ -161,10 +211,51 @@ public:
 			, permanently_unavailable
 		};
 
+		enum class selection_mode_tag {
+			  linear
+			, alias
+			// Takes the less loaded of two couples drawn by weight
+			, power_of_two_choices
+		};
+
 		groups_t groups(uint64_t size = 0) const;
+
+		span_t<group_t> groups_view(uint64_t size = 0) const;
+
+		// Fills the first entries of result, which is never shrunk, and returns their number
+		size_t groups(uint64_t size, size_t count, bool replacement
+				, std::vector<groups_t> &result) const;
+
+		// A key keeps its couple while the couple fits the size and its weight does not change
+		groups_t groups_by_key(uint64_t key_hash, uint64_t size = 0) const;
+
+		// Checks the groupset's free space only, types are "lrc" and "UNKNOWN" in any case
+		std::pair<groups_t, groupset_t> groups_with_groupset(uint64_t size
+				, const std::string &groupset_type) const;
+
+		// Returns groups for every part of part_size bytes
+		std::vector<groups_t> plan_multipart(uint64_t content_length, uint64_t part_size) const;
+
 		couple_sequence_t couple_sequence(uint64_t size = 0) const;
+
+		// With avoid_shared_hosts couples on already offered hosts go last
+		couple_sequence_t couple_sequence(uint64_t size, bool avoid_shared_hosts) const;
 		void set_feedback(group_t couple_id, feedback_tag feedback);
 
+		void set_feedback(group_t couple_id, std::chrono::microseconds latency, uint64_t size);
+
+		// Bytes must be released in the same or a later state of the namespace
+		void reserve(group_t couple_id, uint64_t size);
+		void release(group_t couple_id, uint64_t size);
+
+		// Written bytes are counted until the next namespace state
+		void commit(group_t couple_id, uint64_t size);
+
+		void set_selection_mode(selection_mode_tag selection_mode);
+
+		// Penalized couples double their weight every half-life, zero disables it
+		void set_feedback_half_life(std::chrono::milliseconds half_life);
+
 	private:
 		friend class namespace_state_t;
 
@@ -264,6 +355,8 @@ public:
 	group_info_response_t get_metabalancer_group_info(int group);
 	std::map<int, std::vector<int>> get_symmetric_groups();
 	std::vector<int> get_symmetric_groups(int group);
+	// Writes the result into the buffer, so a reused buffer is not reallocated
+	void get_symmetric_groups(int group, std::vector<int> &result);
 	std::vector<int> get_couple_by_group(int group);
 	std::vector<int> get_couple(int couple_id, const std::string &ns);
 	std::vector<std::vector<int> > get_bad_groups();
@@ -284,6 +377,11 @@ public:
 	groups_t
 	get_cached_groups(const std::string &elliptics_id, group_t couple_id) const;
 
+	// Writes cached groups into result, it is empty if the key is not cached
+	void
+	get_cached_groups(const std::string &elliptics_id, group_t couple_id
+			, groups_t &result) const;
+
 	std::string json_group_weights();
 	std::string json_symmetric_groups();
 	std::string json_bad_groups();
@@ -295,6 +393,10 @@ public:
 	void
 	set_user_settings_factory(namespace_state_t::user_settings_factory_t user_settings_factory);
 
+	// Applies to namespace states received after the call
+	void
+	set_locality(namespace_state_t::locality_t locality);
+
 	void cache_force_update();
 	void set_update_cache_callback(const std::function<void (void)> &callback);
 	void set_update_cache_ext1_callback(const std::function<void (bool)> &callback);
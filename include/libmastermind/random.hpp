@@ -0,0 +1,61 @@
+/*
+	Client library for mastermind
+	Copyright (C) 2013-2015 Yandex
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef LIBMASTERMIND__INCLUDE__LIBMASTERMIND__RANDOM__HPP
+#define LIBMASTERMIND__INCLUDE__LIBMASTERMIND__RANDOM__HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace mastermind {
+
+// Source of random numbers for couple selection.
+// Every thread owns its own generator, so it does not need to be thread-safe.
+class random_generator_t {
+public:
+	virtual ~random_generator_t();
+
+	// Returns a uniformly distributed 64-bit value
+	virtual uint64_t
+	operator () () = 0;
+};
+
+typedef std::unique_ptr<random_generator_t> random_generator_ptr_t;
+
+// The factory is called once per thread with a seed unique for the thread
+typedef std::function<random_generator_ptr_t (uint64_t seed)> random_generator_factory_t;
+
+// Generators already created by threads are recreated on their next use.
+// An empty factory restores the default generator (std::mt19937_64).
+void
+set_random_generator_factory(random_generator_factory_t factory);
+
+// Makes thread generators be seeded with values derived from the seed
+// in order of their creation, so a single-threaded run is reproducible
+void
+set_random_seed(uint64_t seed);
+
+// Returns to seeding thread generators from std::random_device
+void
+reset_random_seed();
+
+} // namespace mastermind
+
+#endif /* LIBMASTERMIND__INCLUDE__LIBMASTERMIND__RANDOM__HPP */
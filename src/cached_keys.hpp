@@ -44,19 +44,11 @@ public:
 
 	groups_t
 	get(const std::string &key, const std::string &couple_id) const {
-		auto key_it = groups_map.find(key);
-
-		if (groups_map.end() == key_it) {
-			return {};
-		}
-
-		auto couple_id_it = key_it->second.find(couple_id);
-
-		if (key_it->second.end() == couple_id_it) {
-			return {};
+		if (auto groups = find(key, couple_id)) {
+			return *groups;
 		}
 
-		return couple_id_it->second;
+		return {};
 	}
 
 	groups_t
@@ -64,9 +56,36 @@ public:
 		return get(key, boost::lexical_cast<std::string>(couple_id));
 	}
 
+	void
+	get(const std::string &key, group_t couple_id, groups_t &result) const {
+		if (auto groups = find(key, boost::lexical_cast<std::string>(couple_id))) {
+			result.assign(groups->begin(), groups->end());
+			return;
+		}
+
+		result.clear();
+	}
+
 private:
 	typedef std::map<std::string, std::map<std::string, groups_t>> groups_map_t;
 
+	const groups_t *
+	find(const std::string &key, const std::string &couple_id) const {
+		auto key_it = groups_map.find(key);
+
+		if (groups_map.end() == key_it) {
+			return 0;
+		}
+
+		auto couple_id_it = key_it->second.find(couple_id);
+
+		if (key_it->second.end() == couple_id_it) {
+			return 0;
+		}
+
+		return &couple_id_it->second;
+	}
+
 	static
 	groups_map_t
 	create_groups_map(const kora::dynamic_t &dynamic) {
@@ -26,6 +26,7 @@ mastermind::couple_sequence_const_iterator_t::couple_sequence_const_iterator_t()
 mastermind::couple_sequence_const_iterator_t::couple_sequence_const_iterator_t(
 		const self_type &that)
 {
+	// The position is copied, drawn couples are shared
 	if (that.data) {
 		data = std::make_shared<data_t>(*that.data);
 	}
@@ -33,12 +34,12 @@ mastermind::couple_sequence_const_iterator_t::couple_sequence_const_iterator_t(
 
 mastermind::couple_sequence_const_iterator_t::reference
 mastermind::couple_sequence_const_iterator_t::operator * () const {
-	return data->couples_info[data->current_index];
+	return data->current();
 }
 
 mastermind::couple_sequence_const_iterator_t::pointer
 mastermind::couple_sequence_const_iterator_t::operator -> () const {
-	return &data->couples_info[data->current_index];
+	return &data->current();
 }
 
 bool
@@ -53,8 +54,7 @@ mastermind::couple_sequence_const_iterator_t::operator == (const self_type &othe
 
 	auto d = (data ? data : other.data);
 
-	if (d->current_index == d->couples_info.size()
-			&& d->weighted_couples_info.empty()) {
+	if (d->is_end()) {
 		return true;
 	}
 
@@ -68,22 +68,25 @@ mastermind::couple_sequence_const_iterator_t::operator != (const self_type &othe
 
 mastermind::couple_sequence_const_iterator_t::self_type &
 mastermind::couple_sequence_const_iterator_t::operator ++ () {
-	data->try_extract_next();
-	data->current_index += 1;
+	data->advance();
 	return *this;
 }
 
 mastermind::couple_sequence_const_iterator_t::self_type
 mastermind::couple_sequence_const_iterator_t::operator ++ (int) {
-	self_type result;
-	result.data = std::make_shared<data_t>(*data);
+	self_type result(*this);
 	++*this;
 	return result;
 }
 
 mastermind::couple_sequence_const_iterator_t::self_type &
 mastermind::couple_sequence_const_iterator_t::operator = (const self_type &that) {
-	data = std::make_shared<data_t>(*that.data);
+	if (that.data) {
+		data = std::make_shared<data_t>(*that.data);
+	} else {
+		data.reset();
+	}
+
 	return *this;
 }
 
@@ -94,7 +97,7 @@ mastermind::couple_sequence_t::begin() const {
 	}
 
 	auto d = std::make_shared<couple_sequence_const_iterator_init_t::data_t>(
-			data->weighted_couples_info);
+			*data->couples_data, data->couples, data->hosts, data->weights_tree);
 	return couple_sequence_const_iterator_init_t(std::move(d));
 }
 
@@ -109,6 +112,6 @@ mastermind::couple_sequence_t::size() const {
 		return 0;
 	}
 
-	return data->weighted_couples_info.size();
+	return data->couples->size();
 }
 
@@ -22,67 +22,299 @@
 
 #include "libmastermind/couple_sequence.hpp"
 #include "couple_weights_p.hpp"
+#include "random_p.hpp"
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
+#include <mutex>
 
 namespace mastermind {
 
+#define INIT_CLASS(name) \
+	class name##_init_t : public name##_t \
+	{ \
+	public: \
+		typedef name##_t::data_t data_t; \
+		 \
+		name##_init_t(std::shared_ptr<data_t> data_) { \
+			data = std::move(data_); \
+		} \
+	}
+
+// Couples are drawn by a state shared by all copies of an iterator, so copies
+// yield the same couples, and copying or advancing an iterator takes O(1)
+// besides the draw of a new couple. Every copy keeps its own position,
+// the shared state is locked, so copies can be used from different threads.
 class couple_sequence_const_iterator_t::data_t
 {
 public:
-	data_t(ns_state::weight::weighted_couples_info_t weighted_couples_info_)
-		: weighted_couples_info(std::move(weighted_couples_info_))
-		, current_index(0)
+	typedef ns_state::weight::couples_data_t couples_data_t;
+	// Indexes of couples in couples_data
+	typedef std::vector<size_t> couples_t;
+	typedef std::vector<const std::vector<size_t> *> hosts_t;
+	typedef ns_state::weight::fenwick_tree_t weights_tree_t;
+
+	class state_t;
+
+	data_t(const couples_data_t &couples_data_
+			, std::shared_ptr<const couples_t> couples_
+			, std::shared_ptr<const hosts_t> hosts_
+			, std::shared_ptr<weights_tree_t> weights_tree_);
+
+	// Tells whether the iterator is past the last couple
+	bool
+	is_end() const;
+
+	const couple_info_t &
+	current() const;
+
+	void
+	advance();
+
+	std::shared_ptr<state_t> state;
+	size_t current_index;
+	// Is null past the last couple
+	const couple_info_t *current_couple;
+};
+
+// Couples are only appended to the state
+class couple_sequence_const_iterator_t::data_t::state_t
+{
+public:
+	state_t(const couples_data_t &couples_data_
+			, std::shared_ptr<const couples_t> couples_
+			, std::shared_ptr<const hosts_t> hosts_
+			, std::shared_ptr<weights_tree_t> weights_tree_)
+		: couples_data(&couples_data_)
+		, couples(std::move(couples_))
+		, hosts(std::move(hosts_))
+		, weights_tree(std::move(weights_tree_))
+		, owns_weights_tree(false)
+		, pending_index(NO_INDEX)
 	{
-		try_extract_next();
+	}
+
+	// Draws couples up to the index, returns null if there are less couples
+	const couple_info_t *
+	get(size_t index) {
+		std::lock_guard<std::mutex> lock_guard(mutex);
+
+		while (couples_info.size() <= index && !is_exhausted()) {
+			try_extract_next();
+		}
+
+		if (index < couples_info.size()) {
+			return &couples_info[index];
+		}
+
+		return 0;
+	}
+
+private:
+	static const size_t NO_INDEX = static_cast<size_t>(-1);
+
+	bool
+	is_exhausted() const {
+		auto total_weight = weights_tree->total_weight();
+
+		if (pending_index != NO_INDEX) {
+			total_weight -= weights_tree->weight(pending_index);
+		}
+
+		return total_weight == 0 && deferred_couples.empty();
 	}
 
 	void
 	try_extract_next() {
-		if (weighted_couples_info.empty()) {
+		if (pending_index != NO_INDEX) {
+			unshare_weights_tree();
+			weights_tree->remove(pending_index);
+			pending_index = NO_INDEX;
+		}
+
+		if (is_exhausted()) {
 			return;
 		}
 
-		auto total_weight = weighted_couples_info.back().weight;
-		double shoot_point = double(random()) / RAND_MAX * total_weight;
-		auto it = std::lower_bound(weighted_couples_info.begin()
-				, weighted_couples_info.end(), uint64_t(shoot_point));
+		size_t index = 0;
+
+		while (true) {
+			if (weights_tree->total_weight() == 0) {
+				restore_deferred_couples();
+			}
+
+			auto total_weight = weights_tree->total_weight();
+			auto shoot_point = std::min(total_weight - 1
+					, uint64_t(random_uniform() * total_weight));
+			index = weights_tree->get(shoot_point);
+
+			if (!shares_hosts(index)) {
+				break;
+			}
+
+			// The couple is offered only after all couples on other hosts
+			unshare_weights_tree();
+			deferred_couples.emplace_back(index, weights_tree->weight(index));
+			weights_tree->remove(index);
+		}
+
+		if (hosts) {
+			const auto &couple_hosts = *(*hosts)[index];
+			used_hosts.insert(used_hosts.end(), couple_hosts.begin(), couple_hosts.end());
+		}
+
+		auto couple_index = (*couples)[index];
+		auto groups = couples_data->groups(couple_index);
 
 		couple_info_t couple_info;
-		couple_info.id = it->couple_info->id;
-		couple_info.groups = it->couple_info->groups;
+		couple_info.id = couples_data->id(couple_index);
+		couple_info.groups.assign(groups.begin(), groups.end());
 		couples_info.emplace_back(couple_info);
 
-		weighted_couples_info.erase(it);
+		// The tree can be shared, it is updated on the next extraction
+		pending_index = index;
 	}
 
-	ns_state::weight::weighted_couples_info_t weighted_couples_info;
-	std::vector<couple_info_t> couples_info;
-	size_t current_index;
+	void
+	unshare_weights_tree() {
+		if (!owns_weights_tree) {
+			weights_tree = std::make_shared<weights_tree_t>(*weights_tree);
+			owns_weights_tree = true;
+		}
+	}
+
+	bool
+	shares_hosts(size_t index) const {
+		if (!hosts) {
+			return false;
+		}
+
+		const auto &couple_hosts = *(*hosts)[index];
+
+		for (auto it = couple_hosts.begin(), end = couple_hosts.end(); it != end; ++it) {
+			if (std::find(used_hosts.begin(), used_hosts.end(), *it) != used_hosts.end()) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// All remaining couples share hosts with yielded ones,
+	// so they are offered again without regard to yielded couples
+	void
+	restore_deferred_couples() {
+		std::vector<uint64_t> weights(couples->size());
+
+		for (auto it = deferred_couples.begin(), end = deferred_couples.end();
+				it != end; ++it) {
+			weights[it->first] = it->second;
+		}
+
+		weights_tree = std::make_shared<weights_tree_t>(weights);
+		owns_weights_tree = true;
+		deferred_couples.clear();
+		used_hosts.clear();
+	}
+
+	// Couples are never changed and are not copied with the state
+	const couples_data_t *couples_data;
+	std::shared_ptr<const couples_t> couples;
+	// Host ids of couples, there are no hosts without anti-affinity
+	std::shared_ptr<const hosts_t> hosts;
+	// Is shared with the sequence and other states until it is changed
+	std::shared_ptr<weights_tree_t> weights_tree;
+	bool owns_weights_tree;
+	size_t pending_index;
+
+	// Hosts of couples yielded since the last restore of deferred couples
+	std::vector<size_t> used_hosts;
+	// Couples which share hosts with yielded ones and their weights
+	std::vector<std::pair<size_t, uint64_t>> deferred_couples;
+
+	// References to yielded couples stay valid while couples are appended
+	std::deque<couple_info_t> couples_info;
+
+	std::mutex mutex;
 };
 
+inline
+couple_sequence_const_iterator_t::data_t::data_t(const couples_data_t &couples_data_
+		, std::shared_ptr<const couples_t> couples_
+		, std::shared_ptr<const hosts_t> hosts_
+		, std::shared_ptr<weights_tree_t> weights_tree_)
+	: state(std::make_shared<state_t>(couples_data_, std::move(couples_)
+				, std::move(hosts_), std::move(weights_tree_)))
+	, current_index(0)
+	, current_couple(state->get(current_index))
+{
+}
+
+inline
+bool
+couple_sequence_const_iterator_t::data_t::is_end() const {
+	return current_couple == 0;
+}
+
+inline
+const couple_info_t &
+couple_sequence_const_iterator_t::data_t::current() const {
+	return *current_couple;
+}
+
+inline
+void
+couple_sequence_const_iterator_t::data_t::advance() {
+	current_index += 1;
+	// Another copy could have drawn the couple already
+	current_couple = state->get(current_index);
+}
+
+INIT_CLASS(couple_sequence_const_iterator);
+
 class couple_sequence_t::data_t
 {
 public:
-	data_t(ns_state::weight::weighted_couples_info_t weighted_couples_info_)
-		: weighted_couples_info(std::move(weighted_couples_info_))
-	{}
+	typedef couple_sequence_const_iterator_init_t::data_t iterator_data_t;
 
-	ns_state::weight::weighted_couples_info_t weighted_couples_info;
-};
+	typedef iterator_data_t::hosts_t hosts_t;
 
-#define INIT_CLASS(name) \
-	class name##_init_t : public name##_t \
-	{ \
-	public: \
-		typedef name##_t::data_t data_t; \
-		 \
-		name##_init_t(std::shared_ptr<data_t> data_) { \
-			data = std::move(data_); \
-		} \
+	// Without hosts the sequence does not care about host anti-affinity,
+	// otherwise hosts must be indexed as weighted_couples_info
+	data_t(const iterator_data_t::couples_data_t &couples_data_
+			, const ns_state::weight::weighted_couples_info_t &weighted_couples_info
+			, std::shared_ptr<const hosts_t> hosts_ = std::shared_ptr<const hosts_t>())
+		: couples_data(&couples_data_)
+		, hosts(std::move(hosts_))
+	{
+		std::vector<uint64_t> weights;
+		weights.reserve(weighted_couples_info.size());
+
+		auto couples_ = std::make_shared<iterator_data_t::couples_t>();
+		couples_->reserve(weighted_couples_info.size());
+
+		uint64_t previous_weight = 0;
+
+		// weighted_couples_info keeps cumulative weights
+		for (auto it = weighted_couples_info.begin(), end = weighted_couples_info.end();
+				it != end; ++it) {
+			weights.emplace_back(it->weight - previous_weight);
+			couples_->emplace_back(it->index);
+			previous_weight = it->weight;
+		}
+
+		couples = std::move(couples_);
+		weights_tree = std::make_shared<iterator_data_t::weights_tree_t>(weights);
 	}
 
-INIT_CLASS(couple_sequence_const_iterator);
+	const iterator_data_t::couples_data_t *couples_data;
+	std::shared_ptr<const iterator_data_t::couples_t> couples;
+	std::shared_ptr<const hosts_t> hosts;
+	// Is never changed, iterators copy it before their first removal
+	std::shared_ptr<iterator_data_t::weights_tree_t> weights_tree;
+};
+
 INIT_CLASS(couple_sequence);
 
 } // namespace mastermind
@@ -19,39 +19,379 @@
 
 #include "couple_weights_p.hpp"
 #include "utils.hpp"
+#include "random_p.hpp"
 
 #include <boost/lexical_cast.hpp>
 
 #include <algorithm>
-#include <cstdlib>
+#include <cmath>
+#include <limits>
 #include <sstream>
 
 namespace mastermind {
 namespace ns_state {
 namespace weight {
 
+namespace {
+
+// Max number of draws rejected by coefficients
+// before the linear selection is used
+const size_t ALIAS_ATTEMPTS = 8;
+
+// A penalized couple gets back half of its penalty in this time
+const std::chrono::milliseconds DEFAULT_FEEDBACK_HALF_LIFE = std::chrono::seconds(10);
+// A couple without weight reported as available restarts from this coefficient
+const double MIN_RECOVERY_COEFFICIENT = 0.01;
+
+// Weight of a new report in the average latency of a couple
+const double COUPLE_LATENCY_SMOOTHING = 0.1;
+// Weight of a new report in the average latency of the namespace
+const double NAMESPACE_LATENCY_SMOOTHING = 0.01;
+// Latency of smaller writes is mostly overhead, they are accounted as this size
+const uint64_t MIN_LATENCY_SIZE = 4096;
+// A slow couple keeps at least this share of its weight
+const double MIN_LATENCY_SCALE = 0.05;
+
+// Low bits of a packed coefficient keep its value as a fixed point number,
+// high bits keep the time it was set at in milliseconds
+const int COEFFICIENT_BITS = 24;
+const uint64_t COEFFICIENT_MASK = (uint64_t(1) << COEFFICIENT_BITS) - 1;
+
+uint64_t
+current_time() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t
+pack_coefficient(double coefficient, uint64_t time) {
+	uint64_t value = 0;
+
+	// No penalty does not need the time
+	if (coefficient >= 1) {
+		return COEFFICIENT_MASK;
+	} else if (coefficient > 0) {
+		// Rounding up keeps a small penalty from turning into a permanent one
+		value = std::ceil(coefficient * COEFFICIENT_MASK);
+	}
+
+	return (time << COEFFICIENT_BITS) | value;
+}
+
+void
+update_average(std::atomic<double> &average, double value, double smoothing) {
+	auto current = average.load();
+
+	// Zero average means there are no values yet
+	while (!average.compare_exchange_weak(current
+				, current == 0 ? value : current + smoothing * (value - current))) {
+	}
+}
+
+} // namespace
+
 bool
 memory_comparator(const couple_info_t &lhs, const couple_info_t &rhs) {
 	return lhs.memory > rhs.memory;
 }
 
+couples_data_t::couples_data_t(size_t groups_count_, const couples_info_t &couples_info)
+	: groups_count(groups_count_)
+{
+	ids.reserve(couples_info.size());
+	groups_.reserve(couples_info.size() * groups_count);
+	weights_.reserve(couples_info.size());
+	memories_.reserve(couples_info.size());
+
+	for (auto it = couples_info.begin(), end = couples_info.end(); it != end; ++it) {
+		ids.emplace_back(it->id);
+		groups_.insert(groups_.end(), it->groups.begin(), it->groups.end());
+		weights_.emplace_back(it->weight);
+		memories_.emplace_back(it->memory);
+	}
+}
+
+size_t
+couples_data_t::size() const {
+	return ids.size();
+}
+
+bool
+couples_data_t::empty() const {
+	return ids.empty();
+}
+
+group_t
+couples_data_t::id(size_t index) const {
+	return ids[index];
+}
+
+span_t<group_t>
+couples_data_t::groups(size_t index) const {
+	return {groups_.data() + index * groups_count, groups_count};
+}
+
+uint64_t
+couples_data_t::weight(size_t index) const {
+	return weights_[index];
+}
+
+uint64_t
+couples_data_t::memory(size_t index) const {
+	return memories_[index];
+}
+
+const std::vector<uint64_t> &
+couples_data_t::weights() const {
+	return weights_;
+}
+
+const std::vector<uint64_t> &
+couples_data_t::memories() const {
+	return memories_;
+}
+
+couple_info_t
+couples_data_t::get(size_t index) const {
+	couple_info_t result;
+	auto couple_groups = groups(index);
+
+	result.groups.assign(couple_groups.begin(), couple_groups.end());
+	result.id = ids[index];
+	result.weight = weights_[index];
+	result.memory = memories_[index];
+
+	return result;
+}
+
+alias_table_t::alias_table_t()
+{
+}
+
+alias_table_t::alias_table_t(const std::vector<uint64_t> &weights) {
+	const size_t size = weights.size();
+	uint64_t total_weight = 0;
+
+	for (auto it = weights.begin(), end = weights.end(); it != end; ++it) {
+		total_weight += *it;
+	}
+
+	if (total_weight == 0) {
+		return;
+	}
+
+	probability.resize(size);
+	alias.resize(size);
+
+	std::vector<double> scaled(size);
+	std::vector<size_t> small;
+	std::vector<size_t> large;
+
+	for (size_t index = 0; index != size; ++index) {
+		scaled[index] = double(weights[index]) * size / total_weight;
+
+		if (scaled[index] < 1) {
+			small.emplace_back(index);
+		} else {
+			large.emplace_back(index);
+		}
+	}
+
+	while (!small.empty() && !large.empty()) {
+		auto less = small.back();
+		small.pop_back();
+		auto more = large.back();
+
+		probability[less] = scaled[less];
+		alias[less] = more;
+
+		scaled[more] = (scaled[more] + scaled[less]) - 1;
+
+		if (scaled[more] < 1) {
+			large.pop_back();
+			small.emplace_back(more);
+		}
+	}
+
+	// The rest have probability 1 up to rounding errors
+	for (auto it = large.begin(), end = large.end(); it != end; ++it) {
+		probability[*it] = 1;
+		alias[*it] = *it;
+	}
+
+	for (auto it = small.begin(), end = small.end(); it != end; ++it) {
+		probability[*it] = 1;
+		alias[*it] = *it;
+	}
+}
+
+bool
+alias_table_t::empty() const {
+	return probability.empty();
+}
+
+size_t
+alias_table_t::get(double shoot_point) const {
+	double point = shoot_point * probability.size();
+	size_t index = std::min(size_t(point), probability.size() - 1);
+
+	if (point - index < probability[index]) {
+		return index;
+	}
+
+	return alias[index];
+}
+
+fenwick_tree_t::fenwick_tree_t()
+	: total(0)
+{
+}
+
+fenwick_tree_t::fenwick_tree_t(const std::vector<uint64_t> &weights_)
+	: tree(weights_.size() + 1)
+	, weights(weights_)
+	, total(0)
+{
+	const size_t size = weights.size();
+
+	for (size_t index = 1; index <= size; ++index) {
+		tree[index] += weights[index - 1];
+		total += weights[index - 1];
+
+		size_t parent = index + (index & -index);
+
+		if (parent <= size) {
+			tree[parent] += tree[index];
+		}
+	}
+}
+
+uint64_t
+fenwick_tree_t::total_weight() const {
+	return total;
+}
+
+uint64_t
+fenwick_tree_t::weight(size_t index) const {
+	return weights[index];
+}
+
+size_t
+fenwick_tree_t::get(uint64_t shoot_point) const {
+	const size_t size = weights.size();
+	size_t step = 1;
+
+	while (step <= size / 2) {
+		step <<= 1;
+	}
+
+	size_t position = 0;
+
+	for (; step != 0; step >>= 1) {
+		if (position + step <= size && tree[position + step] <= shoot_point) {
+			position += step;
+			shoot_point -= tree[position];
+		}
+	}
+
+	// position is the count of leading weights which sum is not greater than shoot_point
+	return position;
+}
+
+void
+fenwick_tree_t::remove(size_t index) {
+	const size_t size = weights.size();
+	auto weight = weights[index];
+
+	weights[index] = 0;
+	total -= weight;
+
+	for (size_t position = index + 1; position <= size; position += position & -position) {
+		tree[position] -= weight;
+	}
+}
+
+weights_t::latency_t::latency_t()
+	: latency(0)
+	, size(0)
+	, time(0)
+{
+}
+
+void
+weights_t::latency_t::add(double latency_, double size_, double smoothing) {
+	update_average(latency, latency_, smoothing);
+	update_average(size, size_, smoothing);
+	time = current_time();
+}
+
+void
+weights_t::latency_t::assign(const latency_t &other) {
+	latency = other.latency.load();
+	size = other.size.load();
+	time = other.time.load();
+}
+
+double
+weights_t::latency_t::cost() const {
+	auto size_ = size.load(std::memory_order_relaxed);
+
+	if (size_ == 0) {
+		return 0;
+	}
+
+	return latency.load(std::memory_order_relaxed) / size_;
+}
+
 weights_t::weights_t(const kora::config_t &config
 		, size_t groups_count_, bool ns_is_static_)
 	try
 	: groups_count(groups_count_)
-	, couples_info(create(config, groups_count, ns_is_static_))
+	, couples_data(create(config, groups_count, ns_is_static_))
+	, coefficients(couples_data.size())
+	, latencies(couples_data.size())
+	, reservations(couples_data.size())
+	, committed(couples_data.size())
+	, group_index(create_group_index(couples_data))
+	, cumulative_weights(create_cumulative_weights(couples_data))
+	, alias_table(couples_data.weights())
+	, alias_memory(alias_min_memory(couples_data))
+	, selection_mode(selection_mode_tag::alias)
+	, half_life(DEFAULT_FEEDBACK_HALF_LIFE.count())
 {
+	for (auto it = coefficients.begin(), end = coefficients.end(); it != end; ++it) {
+		it->store(pack_coefficient(1, 0));
+	}
+
+	for (auto it = reservations.begin(), end = reservations.end(); it != end; ++it) {
+		*it = std::make_shared<std::atomic<uint64_t>>(0);
+	}
+
+	for (auto it = committed.begin(), end = committed.end(); it != end; ++it) {
+		it->store(0);
+	}
 } catch (const std::exception &ex) {
 	throw std::runtime_error(std::string("cannot create weights-state: ") + ex.what());
 }
 
 weights_t::weights_t(weights_t &&other)
 	: groups_count(other.groups_count)
-	, couples_info(std::move(other.couples_info))
+	, couples_data(std::move(other.couples_data))
+	, coefficients(std::move(other.coefficients))
+	, latencies(std::move(other.latencies))
+	, reservations(std::move(other.reservations))
+	, committed(std::move(other.committed))
+	, group_index(std::move(other.group_index))
+	, cumulative_weights(std::move(other.cumulative_weights))
+	, alias_table(std::move(other.alias_table))
+	, alias_memory(other.alias_memory)
+	, selection_mode(other.selection_mode.load())
+	, half_life(other.half_life.load())
 {
+	namespace_latency.assign(other.namespace_latency);
 }
 
-couples_info_t
+couples_data_t
 weights_t::create(
 		const kora::config_t &config, size_t groups_count, bool ns_is_static) {
 	const auto key = boost::lexical_cast<std::string>(groups_count);
@@ -61,12 +401,12 @@ weights_t::create(
 
 	if (object.end() == it) {
 		// TODO: log
-		return {};
+		return {groups_count, {}};
 	}
 
 	if (!it->second.is_array()) {
 		// TODO: log
-		return {};
+		return {groups_count, {}};
 	}
 
 	const auto &couples = it->second.as_array();
@@ -96,17 +436,300 @@ weights_t::create(
 		}
 	}
 
+	// Groups of couples are stored with a fixed stride
+	for (auto it = couples_info.begin(), end = couples_info.end(); it != end; ++it) {
+		if (it->groups.size() != groups_count) {
+			std::ostringstream oss;
+			oss
+				<< "groups.size is not equal to groups_count(" << groups_count
+				<< "), groups=" << it->groups;
+			throw std::runtime_error(oss.str());
+		}
+	}
+
 	std::sort(couples_info.begin(), couples_info.end(), memory_comparator);
 
-	return couples_info;
+	return {groups_count, couples_info};
+}
+
+weights_t::group_index_t
+weights_t::create_group_index(const couples_data_t &couples_data) {
+	group_index_t result;
+
+	for (size_t index = 0, size = couples_data.size(); index != size; ++index) {
+		auto groups = couples_data.groups(index);
+
+		for (auto it = groups.begin(), end = groups.end(); it != end; ++it) {
+			// The first couple with the group wins as it did with the linear search
+			result.insert(std::make_pair(*it, index));
+		}
+	}
+
+	return result;
+}
+
+std::vector<uint64_t>
+weights_t::create_cumulative_weights(const couples_data_t &couples_data) {
+	const auto &weights = couples_data.weights();
+
+	std::vector<uint64_t> result;
+	result.reserve(weights.size());
+	uint64_t total_weight = 0;
+
+	for (auto it = weights.begin(), end = weights.end(); it != end; ++it) {
+		total_weight += *it;
+		result.emplace_back(total_weight);
+	}
+
+	return result;
+}
+
+uint64_t
+weights_t::alias_min_memory(const couples_data_t &couples_data) {
+	uint64_t result = 0;
+
+	// couples_data is sorted by memory in descending order
+	for (size_t index = couples_data.size(); index != 0; --index) {
+		if (couples_data.weight(index - 1) != 0) {
+			result = couples_data.memory(index - 1);
+			break;
+		}
+	}
+
+	return result;
 }
 
 couple_info_t
 weights_t::get(uint64_t size) const {
+	return couples_data.get(select(size));
+}
+
+span_t<group_t>
+weights_t::get_groups(uint64_t size) const {
+	return couples_data.groups(select(size));
+}
+
+size_t
+weights_t::get(uint64_t size, size_t count, bool replacement
+		, std::vector<groups_t> &result) const {
+	// Entries past count keep their memory for the next call
+	if (result.size() < count) {
+		result.resize(count);
+	}
+
+	if (count == 0) {
+		return 0;
+	}
+
+	if (replacement) {
+		for (size_t index = 0; index != count; ++index) {
+			auto groups = couples_data.groups(select(size));
+			result[index].assign(groups.begin(), groups.end());
+		}
+
+		return count;
+	}
+
+	auto weighted_couples_info = get_all(size);
+
+	std::vector<uint64_t> weights;
+	weights.reserve(weighted_couples_info.size());
+	uint64_t previous_weight = 0;
+
+	for (auto it = weighted_couples_info.begin(), end = weighted_couples_info.end();
+			it != end; ++it) {
+		weights.emplace_back(it->weight - previous_weight);
+		previous_weight = it->weight;
+	}
+
+	fenwick_tree_t weights_tree(weights);
+	size_t index = 0;
+
+	for (; index != count && weights_tree.total_weight() != 0; ++index) {
+		auto total_weight = weights_tree.total_weight();
+		auto shoot_point = std::min(total_weight - 1
+				, uint64_t(random_uniform() * total_weight));
+		auto couple_index = weights_tree.get(shoot_point);
+
+		auto groups = couples_data.groups(weighted_couples_info[couple_index].index);
+		result[index].assign(groups.begin(), groups.end());
+
+		weights_tree.remove(couple_index);
+	}
+
+	return index;
+}
+
+size_t
+weights_t::select(uint64_t size) const {
+	switch (selection_mode.load(std::memory_order_relaxed)) {
+	case selection_mode_tag::linear:
+		return select_linear(size);
+	case selection_mode_tag::power_of_two_choices:
+		{
+			auto first_index = select_weighted(size);
+			auto second_index = select_weighted(size);
+
+			return less_loaded(second_index, first_index) ? second_index : first_index;
+		}
+	default:
+		return select_weighted(size);
+	}
+}
+
+size_t
+weights_t::select_weighted(uint64_t size) const {
+	if (!alias_table.empty() && size <= alias_memory) {
+		for (size_t attempt = 0; attempt != ALIAS_ATTEMPTS; ++attempt) {
+			auto index = alias_table.get(random_uniform());
+
+			if (accept(index, size)) {
+				return index;
+			}
+		}
+	} else {
+		// Couples that fit the size are the prefix of couples_data
+		const auto &memories = couples_data.memories();
+		auto end = std::partition_point(memories.begin(), memories.end()
+				, [size] (uint64_t memory) {
+					return size <= memory;
+				});
+		size_t cutoff = end - memories.begin();
+
+		if (cutoff == 0 || cumulative_weights[cutoff - 1] == 0) {
+			throw not_enough_memory_error();
+		}
+
+		auto total_weight = cumulative_weights[cutoff - 1];
+
+		for (size_t attempt = 0; attempt != ALIAS_ATTEMPTS; ++attempt) {
+			auto shoot_point = std::min(total_weight - 1, uint64_t(
+						random_uniform() * total_weight));
+			auto it = std::upper_bound(cumulative_weights.begin()
+					, cumulative_weights.begin() + cutoff, shoot_point);
+			size_t index = it - cumulative_weights.begin();
+
+			if (accept(index, size)) {
+				return index;
+			}
+		}
+	}
+
+	// Most of the weight is cut by coefficients
+	return select_linear(size);
+}
+
+bool
+weights_t::less_loaded(size_t lhs_index, size_t rhs_index) const {
+	auto lhs_reserved = reservations[lhs_index]->load(std::memory_order_relaxed);
+	auto rhs_reserved = reservations[rhs_index]->load(std::memory_order_relaxed);
+
+	if (lhs_reserved != rhs_reserved) {
+		return lhs_reserved < rhs_reserved;
+	}
+
+	return latencies[lhs_index].cost() < latencies[rhs_index].cost();
+}
+
+bool
+weights_t::accept(size_t index, uint64_t size) const {
+	double value = recovered_coefficient(index) * latency_scale(index);
+	auto memory = couples_data.memory(index);
+	auto free_memory = available_memory(index);
+
+	if (free_memory != memory) {
+		if (free_memory < size) {
+			return false;
+		}
+
+		value *= double(free_memory) / memory;
+	}
+
+	return value >= 1
+		|| random_uniform() < value;
+}
+
+double
+weights_t::recovered_coefficient(size_t index) const {
+	auto packed = coefficients[index].load(std::memory_order_relaxed);
+	auto value = packed & COEFFICIENT_MASK;
+
+	// Most of couples have no penalty, they do not need the clock
+	if (value == COEFFICIENT_MASK) {
+		return 1;
+	}
+
+	double result = double(value) / COEFFICIENT_MASK;
+	auto half_life_ = half_life.load(std::memory_order_relaxed);
+
+	if (value == 0 || half_life_ == 0) {
+		return result;
+	}
+
+	auto time = packed >> COEFFICIENT_BITS;
+	auto now = current_time();
+
+	if (now <= time) {
+		return result;
+	}
+
+	result *= std::exp2(double(now - time) / half_life_);
+
+	if (result < 1) {
+		return result;
+	}
+
+	// The recovered couple takes the fast path from now on
+	coefficients[index].compare_exchange_strong(packed, pack_coefficient(1, 0));
+
+	return 1;
+}
+
+uint64_t
+weights_t::available_memory(size_t index) const {
+	auto memory = couples_data.memory(index);
+	auto used = reservations[index]->load(std::memory_order_relaxed)
+		+ committed[index].load(std::memory_order_relaxed);
+
+	return memory > used ? memory - used : 0;
+}
+
+double
+weights_t::latency_scale(size_t index) const {
+	const auto &couple_latency = latencies[index];
+	auto cost = couple_latency.cost();
+	auto namespace_cost = namespace_latency.cost();
+
+	if (namespace_cost == 0 || cost <= namespace_cost) {
+		return 1;
+	}
+
+	double result = namespace_cost / cost;
+	auto half_life_ = half_life.load(std::memory_order_relaxed);
+
+	// The couple gets its traffic back if there are no fresh reports about it
+	if (half_life_ != 0) {
+		auto time = couple_latency.time.load(std::memory_order_relaxed);
+		auto now = current_time();
+
+		if (now > time) {
+			result *= std::exp2(double(now - time) / half_life_);
+		}
+
+		if (result >= 1) {
+			return 1;
+		}
+	}
+
+	return std::max(MIN_LATENCY_SCALE, result);
+}
+
+size_t
+weights_t::select_linear(uint64_t size) const {
 	auto weighted_groups = get_all(size);
 
 	auto total_weight = weighted_groups.back().weight;
-	double shoot_point = double(random()) / RAND_MAX * total_weight;
+	double shoot_point = random_uniform() * total_weight;
 	auto it = std::lower_bound(weighted_groups.begin(), weighted_groups.end()
 			, uint64_t(shoot_point));
 
@@ -114,34 +737,89 @@ weights_t::get(uint64_t size) const {
 		throw couple_not_found_error();
 	}
 
-	return *it->couple_info;
+	return it->index;
+}
+
+couple_info_t
+weights_t::get_by_key(uint64_t key_hash, uint64_t size) const {
+	const auto &weights = couples_data.weights();
+	const auto &memories = couples_data.memories();
+
+	size_t result = couples_data.size();
+	double min_score = std::numeric_limits<double>::infinity();
+
+	for (size_t index = 0, count = couples_data.size(); index != count; ++index) {
+		if (memories[index] < size) {
+			break;
+		}
+
+		// Feedback and uploads only tell whether the couple can take the key,
+		// the score depends on the mastermind weight, so keys move only when
+		// weights change or couples become unusable
+		if (weights[index] == 0 || available_memory(index) < size
+				|| recovered_coefficient(index) == 0) {
+			continue;
+		}
+
+		// Uniform value in (0, 1) which depends only on the key and the couple
+		auto hash = mix(key_hash ^ mix(couples_data.id(index)));
+		double shoot_point = ((hash >> 11) + 0.5) / (uint64_t(1) << 53);
+
+		// The couple with the max of -weight / ln(u) wins, a couple wins a key
+		// with probability proportional to its weight
+		double score = -std::log(shoot_point) / weights[index];
+
+		if (score < min_score) {
+			min_score = score;
+			result = index;
+		}
+	}
+
+	if (result == couples_data.size()) {
+		throw not_enough_memory_error();
+	}
+
+	return couples_data.get(result);
 }
 
 weighted_couples_info_t
 weights_t::get_all(uint64_t size) const {
 	weighted_couples_info_t weighted_couples_info;
-	weighted_couples_info.reserve(couples_info.size());
+	weighted_couples_info.reserve(couples_data.size());
 	uint64_t total_weight = 0;
 
-	{
-		lock_guard_t lock_guard(couples_info_mutex);
-		for (auto it = couples_info.begin(), end = couples_info.end();
-				it != end; ++it) {
+	const auto &weights = couples_data.weights();
+	const auto &memories = couples_data.memories();
 
-			if (it->memory < size) {
-				break;
-			}
+	for (size_t index = 0, count = couples_data.size(); index != count; ++index) {
+		auto memory = memories[index];
 
-			uint64_t weight = it->weight * it->coefficient;
+		if (memory < size) {
+			break;
+		}
 
-			if (weight == 0) {
-				continue;
-			}
+		auto free_memory = available_memory(index);
 
-			total_weight += weight;
+		// Bytes written since the snapshot and bytes of uploads in progress
+		// are not counted in the memory
+		if (free_memory < size) {
+			continue;
+		}
+
+		uint64_t weight = weights[index]
+			* recovered_coefficient(index) * latency_scale(index);
+
+		if (free_memory != memory) {
+			weight *= double(free_memory) / memory;
+		}
 
-			weighted_couples_info.emplace_back(total_weight, it);
+		if (weight == 0) {
+			continue;
 		}
+
+		total_weight += weight;
+
+		weighted_couples_info.emplace_back(total_weight, index);
 	}
 
 	if (weighted_couples_info.empty()) {
@@ -151,23 +829,291 @@ weights_t::get_all(uint64_t size) const {
 	return weighted_couples_info;
 }
 
-const couples_info_t &
+std::vector<groups_t>
+weights_t::plan(uint64_t content_length, uint64_t part_size) const {
+	if (content_length == 0) {
+		return {};
+	}
+
+	if (part_size == 0 || part_size > content_length) {
+		part_size = content_length;
+	}
+
+	const size_t parts_count = (content_length + part_size - 1) / part_size;
+
+	auto weighted_couples_info = get_all(part_size);
+	const size_t size = weighted_couples_info.size();
+
+	std::vector<double> weights(size);
+	std::vector<uint64_t> capacities(size);
+	uint64_t total_capacity = 0;
+	uint64_t previous_weight = 0;
+
+	for (size_t index = 0; index != size; ++index) {
+		const auto &weighted_couple_info = weighted_couples_info[index];
+
+		weights[index] = weighted_couple_info.weight - previous_weight;
+		previous_weight = weighted_couple_info.weight;
+
+		capacities[index] = available_memory(weighted_couple_info.index) / part_size;
+		total_capacity += capacities[index];
+	}
+
+	if (total_capacity < parts_count) {
+		throw not_enough_memory_error();
+	}
+
+	// Expected number of parts of every couple: parts are shared by weight,
+	// couples which cannot hold their share get as many parts as they can
+	// and the rest is shared among others
+	std::vector<double> expected_counts(size, -1);
+	double remaining_count = parts_count;
+
+	while (true) {
+		double total_weight = 0;
+
+		for (size_t index = 0; index != size; ++index) {
+			if (expected_counts[index] < 0) {
+				total_weight += weights[index];
+			}
+		}
+
+		bool capped = false;
+
+		for (size_t index = 0; index != size; ++index) {
+			if (expected_counts[index] >= 0) {
+				continue;
+			}
+
+			double count = remaining_count * weights[index] / total_weight;
+
+			if (count >= capacities[index]) {
+				expected_counts[index] = capacities[index];
+				remaining_count -= capacities[index];
+				capped = true;
+			}
+		}
+
+		if (!capped) {
+			for (size_t index = 0; index != size; ++index) {
+				if (expected_counts[index] < 0) {
+					expected_counts[index] = remaining_count * weights[index] / total_weight;
+				}
+			}
+
+			break;
+		}
+	}
+
+	// Systematic sampling: parts are evenly spaced points with a random offset,
+	// so every couple gets its expected count rounded either down or up
+	std::vector<size_t> counts(size);
+	{
+		double shoot_point = random_uniform();
+		double cumulative_count = 0;
+		size_t index = 0;
+
+		for (size_t part = 0; part != parts_count; ++part, shoot_point += 1) {
+			while (index != size
+					&& (cumulative_count + expected_counts[index] <= shoot_point
+						|| counts[index] == capacities[index])) {
+				cumulative_count += expected_counts[index];
+				index += 1;
+			}
+
+			if (index != size) {
+				counts[index] += 1;
+				continue;
+			}
+
+			// Rounding errors left the part past the last couple,
+			// it goes to any couple which still has room for it
+			for (size_t spare_index = 0; spare_index != size; ++spare_index) {
+				if (counts[spare_index] != capacities[spare_index]) {
+					counts[spare_index] += 1;
+					break;
+				}
+			}
+		}
+	}
+
+	// Parts of a couple are spread over the whole upload
+	std::vector<std::pair<double, size_t>> order;
+	order.reserve(parts_count);
+
+	for (size_t index = 0; index != size; ++index) {
+		for (size_t part = 0; part != counts[index]; ++part) {
+			order.emplace_back((part + 0.5) / counts[index], index);
+		}
+	}
+
+	std::sort(order.begin(), order.end());
+
+	std::vector<groups_t> result;
+	result.reserve(parts_count);
+
+	for (auto it = order.begin(), end = order.end(); it != end; ++it) {
+		auto groups = couples_data.groups(weighted_couples_info[it->second].index);
+		result.emplace_back(groups.begin(), groups.end());
+	}
+
+	return result;
+}
+
+const couples_data_t &
 weights_t::data() const {
-	return couples_info;
+	return couples_data;
 }
 
 void
 weights_t::set_coefficient(group_t couple_id, double coefficient) {
-	for (auto it = couples_info.begin(), end = couples_info.end(); it != end; ++it) {
-		const auto &groups = it->groups;
-		auto cit = std::find(groups.begin(), groups.end(), couple_id);
+	auto it = group_index.find(couple_id);
 
-		if (cit != groups.end()) {
-			lock_guard_t lock_guard(couples_info_mutex);
-			it->coefficient = std::min(it->coefficient, coefficient);
-			break;
+	if (it == group_index.end()) {
+		return;
+	}
+
+	auto index = it->second;
+	auto &current = coefficients[index];
+	auto packed = pack_coefficient(coefficient, current_time());
+	auto value = current.load();
+
+	// The new penalty restarts the recovery only if it is heavier than
+	// what is left from the previous one
+	while (double(packed & COEFFICIENT_MASK) / COEFFICIENT_MASK < recovered_coefficient(index)
+			&& !current.compare_exchange_weak(value, packed)) {
+	}
+}
+
+void
+weights_t::recover_coefficient(group_t couple_id) {
+	auto it = group_index.find(couple_id);
+
+	if (it == group_index.end()) {
+		return;
+	}
+
+	auto index = it->second;
+	auto &current = coefficients[index];
+	auto value = current.load();
+
+	// Couples without penalty are the most of reports
+	if ((value & COEFFICIENT_MASK) == COEFFICIENT_MASK) {
+		return;
+	}
+
+	auto coefficient = std::max(MIN_RECOVERY_COEFFICIENT, 2 * recovered_coefficient(index));
+
+	// The recovery goes on from the new coefficient
+	current.compare_exchange_strong(value, pack_coefficient(coefficient, current_time()));
+}
+
+void
+weights_t::add_latency(group_t couple_id
+		, std::chrono::microseconds latency, uint64_t size) {
+	auto it = group_index.find(couple_id);
+
+	if (it == group_index.end()) {
+		return;
+	}
+
+	double latency_ = latency.count();
+	double size_ = std::max(size, MIN_LATENCY_SIZE);
+
+	latencies[it->second].add(latency_, size_, COUPLE_LATENCY_SMOOTHING);
+	namespace_latency.add(latency_, size_, NAMESPACE_LATENCY_SMOOTHING);
+}
+
+void
+weights_t::reserve(group_t couple_id, uint64_t size) {
+	auto it = group_index.find(couple_id);
+
+	if (it == group_index.end()) {
+		return;
+	}
+
+	*reservations[it->second] += size;
+}
+
+void
+weights_t::release(group_t couple_id, uint64_t size) {
+	auto it = group_index.find(couple_id);
+
+	if (it == group_index.end()) {
+		return;
+	}
+
+	auto &reserved = *reservations[it->second];
+	auto value = reserved.load();
+
+	while (!reserved.compare_exchange_weak(value, value > size ? value - size : 0)) {
+	}
+}
+
+void
+weights_t::commit(group_t couple_id, uint64_t size) {
+	auto it = group_index.find(couple_id);
+
+	if (it == group_index.end()) {
+		return;
+	}
+
+	committed[it->second] += size;
+}
+
+uint64_t
+weights_t::committed_memory(group_t couple_id) const {
+	auto it = group_index.find(couple_id);
+
+	if (it == group_index.end()) {
+		return 0;
+	}
+
+	return committed[it->second].load(std::memory_order_relaxed);
+}
+
+void
+weights_t::inherit_feedback(const weights_t &other) {
+	for (size_t index = 0, size = couples_data.size(); index != size; ++index) {
+		auto id = couples_data.id(index);
+		auto it = other.group_index.find(id);
+
+		if (it == other.group_index.end()) {
+			continue;
+		}
+
+		// The group could be moved to another couple
+		if (other.couples_data.id(it->second) != id) {
+			continue;
+		}
+
+		auto packed = other.coefficients[it->second].load();
+
+		// A zero coefficient never recovers, so mastermind's fresh weight
+		// is the only way to bring the couple back. Recovered coefficients
+		// are left without penalty.
+		if ((packed & COEFFICIENT_MASK) != 0
+				&& other.recovered_coefficient(it->second) < 1) {
+			coefficients[index].store(packed);
 		}
+
+		latencies[index].assign(other.latencies[it->second]);
+		reservations[index] = other.reservations[it->second];
 	}
+
+	namespace_latency.assign(other.namespace_latency);
+	selection_mode = other.selection_mode.load();
+	half_life = other.half_life.load();
+}
+
+void
+weights_t::set_selection_mode(selection_mode_tag selection_mode_) {
+	selection_mode = selection_mode_;
+}
+
+void
+weights_t::set_feedback_half_life(std::chrono::milliseconds half_life_) {
+	half_life = half_life_.count();
 }
 
 } // namespace weight
@@ -25,9 +25,12 @@
 
 #include <tuple>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <functional>
-#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
 
 #ifndef LIBMASTERMIND__SRC__COUPLE_WEIGHTS_P__HPP
 #define LIBMASTERMIND__SRC__COUPLE_WEIGHTS_P__HPP
@@ -43,14 +46,12 @@ public:
 		: id (-1)
 		, weight(0)
 		, memory(0)
-		, coefficient(1)
 	{}
 
 	groups_t groups;
 	group_t id;
 	uint64_t weight;
 	uint64_t memory;
-	double coefficient;
 
 private:
 };
@@ -60,17 +61,58 @@ memory_comparator(const couple_info_t &lhs, const couple_info_t &rhs);
 
 typedef std::vector<couple_info_t> couples_info_t;
 
-class weighted_couple_info_t {
+// Couples are kept field by field, so a scan over one field stays in cache.
+// Groups of all couples are in one array, a couple takes groups_count of them.
+class couples_data_t {
 public:
-	typedef couples_info_t::const_iterator const_iterator_t;
+	// All couples must have groups_count groups
+	couples_data_t(size_t groups_count_, const couples_info_t &couples_info);
+
+	size_t
+	size() const;
+
+	bool
+	empty() const;
+
+	group_t
+	id(size_t index) const;
+
+	span_t<group_t>
+	groups(size_t index) const;
 
-	weighted_couple_info_t(uint64_t weight_, const_iterator_t couple_info_)
+	uint64_t
+	weight(size_t index) const;
+
+	uint64_t
+	memory(size_t index) const;
+
+	const std::vector<uint64_t> &
+	weights() const;
+
+	const std::vector<uint64_t> &
+	memories() const;
+
+	couple_info_t
+	get(size_t index) const;
+
+private:
+	size_t groups_count;
+	std::vector<group_t> ids;
+	std::vector<group_t> groups_;
+	std::vector<uint64_t> weights_;
+	std::vector<uint64_t> memories_;
+};
+
+class weighted_couple_info_t {
+public:
+	weighted_couple_info_t(uint64_t weight_, size_t index_)
 		: weight(weight_)
-		, couple_info(std::move(couple_info_))
+		, index(index_)
 	{}
 
 	uint64_t weight;
-	const_iterator_t couple_info;
+	// Index of the couple in couples_data_t
+	size_t index;
 
 	friend
 	bool
@@ -89,7 +131,59 @@ private:
 
 typedef std::vector<weighted_couple_info_t> weighted_couples_info_t;
 
+// Walker's alias table (Vose's construction) over couples' weights.
+// A couple is picked in O(1) with a single uniform random number.
+class alias_table_t {
+public:
+	alias_table_t();
+
+	alias_table_t(const std::vector<uint64_t> &weights);
+
+	bool
+	empty() const;
+
+	// shoot_point must be in [0, 1)
+	size_t
+	get(double shoot_point) const;
+
+private:
+	std::vector<double> probability;
+	std::vector<size_t> alias;
+};
+
+// Fenwick tree over couples' weights for weighted sampling without replacement.
+// Both picking a couple and removing it take O(log n).
+class fenwick_tree_t {
+public:
+	fenwick_tree_t();
+
+	fenwick_tree_t(const std::vector<uint64_t> &weights);
+
+	uint64_t
+	total_weight() const;
+
+	uint64_t
+	weight(size_t index) const;
+
+	// Returns the first index which cumulative weight is greater than shoot_point,
+	// shoot_point must be less than total_weight()
+	size_t
+	get(uint64_t shoot_point) const;
+
+	// Sets the weight of the index to zero
+	void
+	remove(size_t index);
+
+private:
+	// tree[i] keeps the sum of weights in (i - lowbit(i), i], it is 1-based
+	std::vector<uint64_t> tree;
+	std::vector<uint64_t> weights;
+	uint64_t total;
+};
+
 struct weights_t {
+	typedef namespace_state_t::weights_t::selection_mode_tag selection_mode_tag;
+
 	weights_t(const kora::config_t &config, size_t groups_count_, bool ns_is_static_);
 
 	weights_t(weights_t &&other);
@@ -97,26 +191,176 @@ struct weights_t {
 	couple_info_t
 	get(uint64_t size) const;
 
+	// Returns groups of the selected couple without a copy
+	span_t<group_t>
+	get_groups(uint64_t size) const;
+
+	// Writes groups of count couples into the first entries of result and returns
+	// the number of them, without replacement it can be less than count.
+	// result is never shrunk, so a reused buffer keeps its memory.
+	size_t
+	get(uint64_t size, size_t count, bool replacement, std::vector<groups_t> &result) const;
+
+	// Returns the couple with the highest weighted rendezvous score for the key
+	couple_info_t
+	get_by_key(uint64_t key_hash, uint64_t size) const;
+
 	weighted_couples_info_t
 	get_all(uint64_t size) const;
 
-	const couples_info_t &
+	// Returns groups for every part of a multipart upload
+	std::vector<groups_t>
+	plan(uint64_t content_length, uint64_t part_size) const;
+
+	const couples_data_t &
 	data() const;
 
 	void
 	set_coefficient(group_t couple_id, double coefficient);
 
+	// Doubles the coefficient as if one more half-life has passed,
+	// a zero coefficient starts its recovery from MIN_RECOVERY_COEFFICIENT
+	void
+	recover_coefficient(group_t couple_id);
+
+	void
+	add_latency(group_t couple_id, std::chrono::microseconds latency, uint64_t size);
+
+	void
+	reserve(group_t couple_id, uint64_t size);
+
+	void
+	release(group_t couple_id, uint64_t size);
+
+	void
+	commit(group_t couple_id, uint64_t size);
+
+	// Returns bytes written to the couple since the snapshot
+	uint64_t
+	committed_memory(group_t couple_id) const;
+
+	// Takes coefficients and latencies of the same couples, shares their
+	// reservations and takes the selection mode and the half-life from
+	// the previous state of the namespace. Couples
+	// reported as permanently unavailable get their weight back with the state.
+	void
+	inherit_feedback(const weights_t &other);
+
+	void
+	set_selection_mode(selection_mode_tag selection_mode_);
+
+	void
+	set_feedback_half_life(std::chrono::milliseconds half_life_);
+
 private:
-	typedef std::mutex mutex_t;
-	typedef std::lock_guard<mutex_t> lock_guard_t;
+	// Coefficients are indexed as couples_data and are read without locks
+	// because set_coefficient can be called concurrently with selection.
+	// Every coefficient is packed with the time it was set at into one word,
+	// so both of them are changed atomically. Readers store a fully recovered
+	// coefficient as no penalty.
+	typedef std::vector<std::atomic<uint64_t>> coefficients_t;
+
+	// Moving averages of latency and size of writes reported by the client,
+	// their ratio is the time a couple spends on a byte
+	struct latency_t {
+		latency_t();
+
+		void
+		add(double latency_, double size_, double smoothing);
+
+		void
+		assign(const latency_t &other);
+
+		// Returns zero if there are no reports yet
+		double
+		cost() const;
+
+		std::atomic<double> latency;
+		std::atomic<double> size;
+		// In milliseconds
+		std::atomic<uint64_t> time;
+	};
+
+	typedef std::vector<latency_t> latencies_t;
+
+	// Maps every group of a couple to the couple's index in couples_data
+	typedef std::unordered_map<group_t, size_t> group_index_t;
 
 	static
-	couples_info_t
+	couples_data_t
 	create(const kora::config_t &config, size_t groups_count, bool ns_is_static);
 
+	static
+	group_index_t
+	create_group_index(const couples_data_t &couples_data);
+
+	static
+	std::vector<uint64_t>
+	create_cumulative_weights(const couples_data_t &couples_data);
+
+	static
+	uint64_t
+	alias_min_memory(const couples_data_t &couples_data);
+
+	// Returns index of the selected couple in couples_data
+	size_t
+	select(uint64_t size) const;
+
+	// Draws a couple from the alias table or from the cumulative weights
+	size_t
+	select_weighted(uint64_t size) const;
+
+	size_t
+	select_linear(uint64_t size) const;
+
+	// Tells whether the first couple is less loaded than the second one
+	bool
+	less_loaded(size_t lhs_index, size_t rhs_index) const;
+
+	// Accepts the couple with probability equal to its coefficient
+	// if the couple has enough memory left by reservations
+	bool
+	accept(size_t index, uint64_t size) const;
+
+	// Returns the memory of the couple without reserved and committed bytes
+	uint64_t
+	available_memory(size_t index) const;
+
+	// Returns the coefficient of the couple recovered by the current time
+	double
+	recovered_coefficient(size_t index) const;
+
+	// Returns the share of the weight the couple keeps because of its latency
+	double
+	latency_scale(size_t index) const;
+
 	const size_t groups_count;
-	couples_info_t couples_info;
-	mutable mutex_t couples_info_mutex;
+	couples_data_t couples_data;
+	mutable coefficients_t coefficients;
+	latencies_t latencies;
+	// Bytes of uploads in progress. Counters of the same couples are shared
+	// with the next states of the namespace, so selections right after an update
+	// see uploads still in flight and an upload can be released in any state.
+	std::vector<std::shared_ptr<std::atomic<uint64_t>>> reservations;
+	// Bytes written since the snapshot, the next snapshot accounts them itself
+	std::vector<std::atomic<uint64_t>> committed;
+	latency_t namespace_latency;
+	group_index_t group_index;
+
+	// Cumulative mastermind weights of couples_data, a size filter cuts
+	// a prefix of it because couples_data is sorted by memory
+	std::vector<uint64_t> cumulative_weights;
+
+	// The table is built once per snapshot from the mastermind weights only,
+	// coefficients are applied by rejection during selection
+	alias_table_t alias_table;
+	// The lowest memory among couples with non-zero weight,
+	// the alias table can be used only if all of them fit the size
+	uint64_t alias_memory;
+
+	std::atomic<selection_mode_tag> selection_mode;
+	// In milliseconds
+	std::atomic<uint64_t> half_life;
 };
 
 } // namespace weight
@@ -86,6 +86,8 @@ public:
 			return "unknown groupset";
 		case mastermind_errc::remotes_empty:
 			return "remotes list is empty";
+		case mastermind_errc::unknown_groupset_type:
+			return "unknown groupset type";
 		default:
 			return "unknown mastermind error";
 		}
@@ -193,5 +195,15 @@ remotes_empty_error::remotes_empty_error()
 	: mastermind_error(std::make_error_code(mastermind::mastermind_errc::remotes_empty))
 {}
 
+unknown_groupset_type_error::unknown_groupset_type_error(std::string groupset_type_)
+	: mastermind_error(std::make_error_code(mastermind::mastermind_errc::unknown_groupset_type))
+	, m_groupset_type(std::move(groupset_type_))
+{}
+
+const std::string &
+unknown_groupset_type_error::groupset_type() const {
+	return m_groupset_type;
+}
+
 } // namespace mastermind
 
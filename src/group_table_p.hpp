@@ -0,0 +1,140 @@
+/*
+	Client library for mastermind
+	Copyright (C) 2013-2015 Yandex
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef LIBMASTERMIND__SRC__GROUP_TABLE_P__HPP
+#define LIBMASTERMIND__SRC__GROUP_TABLE_P__HPP
+
+#include "libmastermind/common.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace mastermind {
+
+// Read-only table of groups built once per snapshot. Group ids are mostly small
+// and dense, so a group is found by its id in a direct index table. Sparse ids
+// fall back to binary search over entries sorted by id.
+template <typename T>
+class group_table_t {
+public:
+	typedef std::pair<group_t, T> value_type;
+	typedef const value_type *const_iterator;
+	typedef value_type *iterator;
+
+	group_table_t()
+		: min_group(0)
+	{}
+
+	// Entries must be sorted by group and must not repeat groups
+	void
+	assign(std::vector<value_type> entries_) {
+		entries = std::move(entries_);
+		slots.clear();
+		min_group = 0;
+
+		if (entries.empty()) {
+			return;
+		}
+
+		min_group = entries.front().first;
+		uint64_t range = int64_t(entries.back().first) - min_group + 1;
+
+		if (range > entries.size() * DENSITY + MIN_SLOTS) {
+			return;
+		}
+
+		slots.assign(range, uint32_t(NO_ENTRY));
+
+		for (size_t index = 0, size = entries.size(); index != size; ++index) {
+			slots[entries[index].first - min_group] = index;
+		}
+	}
+
+	const_iterator
+	find(group_t group) const {
+		if (!slots.empty()) {
+			uint64_t slot = int64_t(group) - min_group;
+
+			if (slot >= slots.size() || slots[slot] == NO_ENTRY) {
+				return end();
+			}
+
+			return entries.data() + slots[slot];
+		}
+
+		auto it = std::lower_bound(entries.begin(), entries.end(), group
+				, [] (const value_type &entry, group_t group) {
+					return entry.first < group;
+				});
+
+		if (it == entries.end() || it->first != group) {
+			return end();
+		}
+
+		return &*it;
+	}
+
+	const_iterator
+	begin() const {
+		return entries.data();
+	}
+
+	const_iterator
+	end() const {
+		return entries.data() + entries.size();
+	}
+
+	iterator
+	begin() {
+		return entries.data();
+	}
+
+	iterator
+	end() {
+		return entries.data() + entries.size();
+	}
+
+	size_t
+	size() const {
+		return entries.size();
+	}
+
+	bool
+	empty() const {
+		return entries.empty();
+	}
+
+private:
+	static const uint32_t NO_ENTRY = static_cast<uint32_t>(-1);
+
+	// The direct index is used while it takes at most this many slots per group
+	// plus MIN_SLOTS, otherwise binary search is cheaper in memory
+	static const size_t DENSITY = 4;
+	static const size_t MIN_SLOTS = 1024;
+
+	std::vector<value_type> entries;
+	std::vector<uint32_t> slots;
+	group_t min_group;
+};
+
+} // namespace mastermind
+
+#endif /* LIBMASTERMIND__SRC__GROUP_TABLE_P__HPP */
@@ -223,10 +223,22 @@ std::map<int, std::vector<int>> mastermind_t::get_symmetric_groups() {
 }
 
 std::vector<int> mastermind_t::get_symmetric_groups(int group) {
-	std::vector<int> result = get_couple_by_group(group);
+	std::vector<int> result;
+	get_symmetric_groups(group, result);
+	return result;
+}
+
+void mastermind_t::get_symmetric_groups(int group, std::vector<int> &result) {
+	{
+		auto cache = m_data->fake_groups_info.copy();
+		auto git = cache.get_value().find(group);
 
-	if (result.empty()) {
-		result = {group};
+		if (git != cache.get_value().end() && !git->second.groups.empty()) {
+			const auto &groups = git->second.groups;
+			result.assign(groups.begin(), groups.end());
+		} else {
+			result.assign(1, group);
+		}
 	}
 
 	if (m_data->m_logger->verbosity() >= cocaine::logging::debug) {
@@ -247,8 +259,6 @@ std::vector<int> mastermind_t::get_symmetric_groups(int group) {
 		auto msg = oss.str();
 		COCAINE_LOG_DEBUG(m_data->m_logger, "%s", msg.c_str());
 	}
-
-	return result;
 }
 
 std::vector<int> mastermind_t::get_couple_by_group(int group) {
@@ -375,14 +385,15 @@ std::vector<std::tuple<std::vector<int>, uint64_t, uint64_t>> mastermind_t::get_
 
 	std::map<int, std::tuple<std::vector<int>, uint64_t, uint64_t>> result_map;
 
-	for (auto it = weights.begin(), end = weights.end(); it != end; ++it) {
-		auto weight = it->weight;
-		auto memory = it->memory;
-		const auto &couple = it->groups;
-		auto group_id = it->id;
+	for (size_t index = 0, size = weights.size(); index != size; ++index) {
+		auto weight = weights.weight(index);
+		auto memory = weights.memory(index);
+		auto groups = weights.groups(index);
+		auto group_id = weights.id(index);
 
 		result_map.insert(std::make_pair(group_id
-					, std::make_tuple(couple, weight, memory)));
+					, std::make_tuple(std::vector<int>(groups.begin(), groups.end())
+						, weight, memory)));
 	}
 
 	{
@@ -449,6 +460,13 @@ mastermind_t::get_cached_groups(const std::string &elliptics_id, group_t couple_
 	return cache.get_value().get(elliptics_id, couple_id);
 }
 
+void
+mastermind_t::get_cached_groups(const std::string &elliptics_id, group_t couple_id
+		, groups_t &result) const {
+	auto cache = m_data->cached_keys.copy();
+	cache.get_value().get(elliptics_id, couple_id, result);
+}
+
 std::string mastermind_t::json_group_weights() {
 	auto cache = m_data->namespaces_states.copy();
 
@@ -572,6 +590,11 @@ mastermind_t::set_user_settings_factory(namespace_state_t::user_settings_factory
 	m_data->set_user_settings_factory(std::move(user_settings_factory));
 }
 
+void
+mastermind_t::set_locality(namespace_state_t::locality_t locality) {
+	m_data->set_locality(std::move(locality));
+}
+
 void mastermind_t::cache_force_update() {
 	m_data->cache_force_update();
 }
@@ -304,6 +304,14 @@ mastermind_t::data::collect_namespaces_states() {
 
 				auto ns_state = create_namespaces_states(name, it->second);
 
+				try {
+					// Feedback about couples must survive the update
+					auto old_ns_state = namespaces_states.copy(name);
+					ns_state.weights.inherit_feedback(old_ns_state.get_value_unsafe().weights);
+				} catch (const unknown_namespace_error &) {
+					// That is a new namespace
+				}
+
 				// TODO: check new ns_state is better than the old one
 				// auto old_ns_state = namespaces_states.copy(name);
 				// if (ns_state is better than old_ns_state) {
@@ -607,7 +615,7 @@ namespace_state_init_t::data_t
 mastermind_t::data::create_namespaces_states(const std::string &name
 		, const kora::dynamic_t &raw_value) {
 	namespace_state_init_t::data_t ns_state{name
-		, kora::config_t(name, raw_value), user_settings_factory};
+		, kora::config_t(name, raw_value), user_settings_factory, locality};
 	COCAINE_LOG_INFO(m_logger, "libmastermind: namespace_state: %s", ns_state.extract.c_str());
 	return ns_state;
 }
@@ -802,6 +810,13 @@ mastermind_t::data::set_user_settings_factory(namespace_state_t::user_settings_f
 	user_settings_factory = std::move(user_settings_factory_);
 }
 
+void
+mastermind_t::data::set_locality(namespace_state_t::locality_t locality_) {
+	std::lock_guard<std::mutex> lock_guard(m_mutex);
+
+	locality = std::move(locality_);
+}
+
 void mastermind_t::data::cache_force_update() {
 	std::lock_guard<std::mutex> lock(m_mutex);
 	(void) lock;
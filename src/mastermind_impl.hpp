@@ -138,6 +138,9 @@ struct mastermind_t::data {
 	void
 	set_user_settings_factory(namespace_state_t::user_settings_factory_t user_settings_factory_);
 
+	void
+	set_locality(namespace_state_t::locality_t locality_);
+
 	void cache_force_update();
 	void set_update_cache_callback(const std::function<void (void)> &callback);
 	void set_update_cache_ext1_callback(const std::function<void (bool)> &callback);
@@ -183,6 +186,7 @@ struct mastermind_t::data {
 	std::chrono::milliseconds reconnect_timeout;
 
 	namespace_state_t::user_settings_factory_t user_settings_factory;
+	namespace_state_t::locality_t locality;
 
 	bool cache_is_expired;
 	// m_cache_update_callback with cache expiration info
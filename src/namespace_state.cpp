@@ -46,9 +46,17 @@ mastermind::namespace_state_t::data_t::settings_t::settings_t(settings_t &&other
 {
 }
 
-mastermind::namespace_state_t::data_t::couples_t::couples_t(const kora::config_t &state)
+mastermind::namespace_state_t::data_t::couples_t::couples_t(const kora::config_t &state
+		, const locality_t &locality)
 	try
 {
+	std::map<std::string, size_t> host_ids;
+	std::vector<group_info_map_t::value_type> groups_info;
+
+	// TODO: remove when "replicas" becomes a separate groupset in 'groupset_info_map'
+	const auto replicas_id = strings.intern("replicas");
+	default_read_preference = strings.intern(string_table_t::ids_t{replicas_id});
+
 	for (size_t index = 0, size = state.size(); index != size; ++index) {
 		const auto &couple_info_state = state.at(index);
 
@@ -90,6 +98,32 @@ mastermind::namespace_state_t::data_t::couples_t::couples_t(const kora::config_t
 
 		couple_info.hosts = couple_info_state.at("hosts").underlying_object();
 
+		collect_hosts(couple_info.hosts, -1, couple_info.host_infos);
+
+		{
+			const auto &hosts = couple_info.host_infos;
+
+			for (auto it = hosts.begin(), end = hosts.end(); it != end; ++it) {
+				auto insert_result = host_ids.insert(std::make_pair(it->host, host_ids.size()));
+				couple_info.host_ids.emplace_back(std::get<0>(insert_result)->second);
+			}
+
+			std::sort(couple_info.host_ids.begin(), couple_info.host_ids.end());
+			couple_info.host_ids.erase(std::unique(couple_info.host_ids.begin()
+						, couple_info.host_ids.end()), couple_info.host_ids.end());
+		}
+
+		{
+			const auto &hosts = couple_info.host_infos;
+			couple_info.read_groups = couple_info.groups;
+
+			std::stable_sort(couple_info.read_groups.begin(), couple_info.read_groups.end()
+					, [&hosts, &locality] (group_t lhs, group_t rhs) {
+						return locality_rank(lhs, hosts, locality)
+							< locality_rank(rhs, hosts, locality);
+					});
+		}
+
 		const auto &groups_info_state = couple_info_state.at("groups");
 
 		for (size_t index = 0, size = groups_info_state.size(); index != size; ++index) {
@@ -97,15 +131,8 @@ mastermind::namespace_state_t::data_t::couples_t::couples_t(const kora::config_t
 
 			auto group_id = group_info_state.at<group_t>("id");
 
-			auto gi_insert_result = group_info_map.insert(std::make_pair(
-						group_id, group_info_t()));
-
-			if (std::get<1>(gi_insert_result) == false) {
-				throw std::runtime_error("resuse the same group_id="
-						+ boost::lexical_cast<std::string>(group_id));
-			}
-
-			auto &group_info = std::get<0>(gi_insert_result)->second;
+			groups_info.emplace_back(group_id, group_info_t());
+			auto &group_info = groups_info.back().second;
 
 			group_info.id = group_id;
 
@@ -120,9 +147,10 @@ mastermind::namespace_state_t::data_t::couples_t::couples_t(const kora::config_t
 			}
 
 			group_info.couple_info_map_iterator = std::get<0>(ci_insert_result);
-			couple_info.groups_info_map_iterator.emplace_back(std::get<0>(gi_insert_result));
 		}
 
+		couple_info.read_preference = default_read_preference;
+
 		if (couple_info_state.has("groupsets")) {
 			const auto &groupsets_state = couple_info_state.at("groupsets").underlying_object().as_object();
 			for (auto it = groupsets_state.begin(); it != groupsets_state.end(); ++it) {
@@ -154,17 +182,80 @@ mastermind::namespace_state_t::data_t::couples_t::couples_t(const kora::config_t
 				groupset_info.free_reserved_space = groupset_info_state.at("free_reserved_space", 0).as_uint();
 
 				groupset_info.hosts = groupset_info_state.at("hosts").as_object();
+				collect_hosts(groupset_info.hosts, -1, groupset_info.host_infos);
 				groupset_info.settings = groupset_info_state.at("settings").as_object();
 			}
 
 			if (!groupsets_state.empty()) {
 				const auto &readpref_state = couple_info_state.at("read_preference").underlying_object().as_array();
-				couple_info.read_preference.resize(readpref_state.size());
-				std::transform(readpref_state.begin(), readpref_state.end(), couple_info.read_preference.begin(),
-					[] (const kora::dynamic_t & pref) { return pref.as_string(); });
+				string_table_t::ids_t read_preference(readpref_state.size());
+				std::transform(readpref_state.begin(), readpref_state.end(), read_preference.begin(),
+					[this] (const kora::dynamic_t & pref) { return strings.intern(pref.as_string()); });
+
+				if (!read_preference.empty()) {
+					couple_info.read_preference = strings.intern(read_preference);
+				}
 			}
 		}
+
+		{
+			string_table_t::ids_t groupset_ids;
+			const auto &map = couple_info.groupset_info_map;
+
+			for (auto it = map.begin(); it != map.end(); it++) {
+				groupset_ids.emplace_back(strings.intern(it->first));
+			}
+
+			if (std::find(groupset_ids.begin(), groupset_ids.end(), replicas_id)
+					== groupset_ids.end()) {
+				groupset_ids.emplace_back(replicas_id);
+			}
+
+			couple_info.groupset_ids = strings.intern(groupset_ids);
+		}
+	}
+
+	std::sort(groups_info.begin(), groups_info.end()
+			, [] (const group_info_map_t::value_type &lhs
+				, const group_info_map_t::value_type &rhs) {
+				return lhs.first < rhs.first;
+			});
+
+	for (size_t index = 1, size = groups_info.size(); index < size; ++index) {
+		if (groups_info[index - 1].first == groups_info[index].first) {
+			throw std::runtime_error("resuse the same group_id="
+					+ boost::lexical_cast<std::string>(groups_info[index].first));
+		}
 	}
+
+	group_info_map.assign(std::move(groups_info));
+
+	// Groups are linked to couples when they do not move anymore
+	for (auto it = group_info_map.begin(), end = group_info_map.end(); it != end; ++it) {
+		auto &couple_info = couple_info_map.find(
+				it->second.couple_info_map_iterator->first)->second;
+		couple_info.groups_info_map_iterator.emplace_back(it);
+	}
+
+	free_space_index.reserve(couple_info_map.size());
+
+	for (auto it = couple_info_map.begin(), end = couple_info_map.end(); it != end; ++it) {
+		const auto &groups = it->second.groups;
+
+		if (groups.empty()) {
+			continue;
+		}
+
+		couple_space_t couple_space;
+		couple_space.couple_id = *std::min_element(groups.begin(), groups.end());
+		couple_space.free_effective_space = it->second.free_effective_space;
+		free_space_index.emplace_back(couple_space);
+	}
+
+	std::sort(free_space_index.begin(), free_space_index.end()
+			, [] (const couple_space_t &lhs, const couple_space_t &rhs) {
+				return lhs.free_effective_space > rhs.free_effective_space;
+			});
 } catch (const std::exception &ex) {
 	throw std::runtime_error(std::string("cannot create couples-state: ") + ex.what());
 }
@@ -172,9 +263,102 @@ mastermind::namespace_state_t::data_t::couples_t::couples_t(const kora::config_t
 mastermind::namespace_state_t::data_t::couples_t::couples_t(couples_t &&other)
 	: group_info_map(std::move(other.group_info_map))
 	, couple_info_map(std::move(other.couple_info_map))
+	, strings(std::move(other.strings))
+	, default_read_preference(other.default_read_preference)
+	, free_space_index(std::move(other.free_space_index))
 {
 }
 
+void
+mastermind::namespace_state_t::data_t::couples_t::collect_hosts(const kora::dynamic_t &dynamic
+		, group_t group, std::vector<host_info_t> &hosts) {
+	if (dynamic.is_array()) {
+		const auto &array = dynamic.as_array();
+
+		for (auto it = array.begin(), end = array.end(); it != end; ++it) {
+			collect_hosts(*it, group, hosts);
+		}
+	} else if (dynamic.is_object()) {
+		const auto &object = dynamic.as_object();
+
+		{
+			auto it = object.find("group_id");
+
+			if (it != object.end() && (it->second.is_uint() || it->second.is_int())) {
+				group = it->second.to<group_t>();
+			}
+		}
+
+		{
+			auto it = object.find("host");
+
+			if (it != object.end() && it->second.is_string()) {
+				host_info_t host_info;
+				host_info.group = group;
+				host_info.host = it->second.as_string();
+				host_info.port = 0;
+				host_info.family = 0;
+
+				auto port_it = object.find("port");
+
+				if (port_it != object.end()
+						&& (port_it->second.is_uint() || port_it->second.is_int())) {
+					host_info.port = static_cast<uint16_t>(port_it->second.to<uint64_t>());
+				}
+
+				auto family_it = object.find("family");
+
+				if (family_it != object.end()
+						&& (family_it->second.is_uint() || family_it->second.is_int())) {
+					host_info.family = family_it->second.to<int>();
+				}
+
+				auto dc_it = object.find("dc");
+
+				if (dc_it != object.end() && dc_it->second.is_string()) {
+					host_info.dc = dc_it->second.as_string();
+				}
+
+				hosts.emplace_back(std::move(host_info));
+				return;
+			}
+		}
+
+		for (auto it = object.begin(), end = object.end(); it != end; ++it) {
+			char *key_end = 0;
+			auto key_group = std::strtol(it->first.c_str(), &key_end, 10);
+
+			if (!it->first.empty() && *key_end == '\0') {
+				collect_hosts(it->second, key_group, hosts);
+			} else {
+				collect_hosts(it->second, group, hosts);
+			}
+		}
+	}
+}
+
+int
+mastermind::namespace_state_t::data_t::couples_t::locality_rank(group_t group
+		, const std::vector<host_info_t> &hosts, const locality_t &locality) {
+	int result = 2;
+
+	for (auto it = hosts.begin(), end = hosts.end(); it != end; ++it) {
+		if (it->group != group) {
+			continue;
+		}
+
+		if (!locality.host.empty() && it->host == locality.host) {
+			return 0;
+		}
+
+		if (!locality.dc.empty() && it->dc == locality.dc) {
+			result = 1;
+		}
+	}
+
+	return result;
+}
+
 mastermind::namespace_state_t::data_t::statistics_t::statistics_t(const kora::config_t &config)
 	try
 	: is_full(config.at("is_full", false))
@@ -190,13 +374,14 @@ mastermind::namespace_state_t::data_t::statistics_t::ns_is_full() const {
 }
 
 mastermind::namespace_state_t::data_t::data_t(std::string name_, const kora::config_t &config
-		, const user_settings_factory_t &factory)
+		, const user_settings_factory_t &factory, const locality_t &locality)
 	try
 	: name(std::move(name_))
 	, settings(name, config.at("settings"), factory)
-	, couples(config.at("couples"))
+	, couples(config.at("couples"), locality)
 	, weights(config.at("weights"), settings.groups_count, !settings.static_groups.empty())
 	, statistics(config.at("statistics"))
+	, couples_hosts(create_couples_hosts(couples, weights))
 {
 	check_consistency();
 
@@ -210,10 +395,34 @@ mastermind::namespace_state_t::data_t::data_t(data_t &&other)
 	, couples(std::move(other.couples))
 	, weights(std::move(other.weights))
 	, statistics(std::move(other.statistics))
+	, couples_hosts(std::move(other.couples_hosts))
 	, extract(std::move(other.extract))
 {
 }
 
+mastermind::namespace_state_t::data_t::couples_hosts_t
+mastermind::namespace_state_t::data_t::create_couples_hosts(const couples_t &couples
+		, const ns_state::weight::weights_t &weights) {
+	static const std::vector<size_t> no_hosts;
+
+	const auto &weights_data = weights.data();
+	couples_hosts_t result;
+	result.reserve(weights_data.size());
+
+	for (size_t index = 0, size = weights_data.size(); index != size; ++index) {
+		auto git = couples.group_info_map.find(weights_data.id(index));
+
+		if (git == couples.group_info_map.end()) {
+			result.emplace_back(&no_hosts);
+			continue;
+		}
+
+		result.emplace_back(&git->second.couple_info_map_iterator->second.host_ids);
+	}
+
+	return result;
+}
+
 void
 mastermind::namespace_state_t::data_t::check_consistency() {
 	std::ostringstream oss;
@@ -232,8 +441,9 @@ mastermind::namespace_state_t::data_t::check_consistency() {
 
 		const auto &weights_data = weights.data();
 
-		for (auto it = weights_data.begin(), end = weights_data.end(); it != end; ++it) {
-			auto weight = it->weight;
+		// Weights have already checked that every couple has groups_count groups
+		for (size_t index = 0, size = weights_data.size(); index != size; ++index) {
+			auto weight = weights_data.weight(index);
 
 			if (weight != 0) {
 				nonzero_weights += 1;
@@ -241,15 +451,8 @@ mastermind::namespace_state_t::data_t::check_consistency() {
 
 			{
 				auto couple_it = couples.couple_info_map.cend();
-				const auto &groups = it->groups;
-
-				if (groups.size() != settings.groups_count) {
-					std::ostringstream oss;
-					oss
-						<< "groups.size is not equal to groups_count(" << settings.groups_count
-						<< "), groups=" << groups;
-					throw std::runtime_error(oss.str());
-				}
+				auto couple_groups = weights_data.groups(index);
+				groups_t groups(couple_groups.begin(), couple_groups.end());
 
 				for (auto git = groups.begin(), gend = groups.end(); git != gend; ++git) {
 					auto group_info_it = couples.group_info_map.find(*git);
@@ -312,8 +515,9 @@ mastermind::namespace_state_init_t::namespace_state_init_t(
 }
 
 mastermind::namespace_state_init_t::data_t::data_t(std::string name
-		, const kora::config_t &config, const user_settings_factory_t &factory)
-	: namespace_state_t::data_t(std::move(name), config, factory)
+		, const kora::config_t &config, const user_settings_factory_t &factory
+		, const locality_t &locality)
+	: namespace_state_t::data_t(std::move(name), config, factory, locality)
 {
 }
 
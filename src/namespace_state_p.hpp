@@ -22,6 +22,8 @@
 
 #include "libmastermind/mastermind.hpp"
 #include "couple_weights_p.hpp"
+#include "group_table_p.hpp"
+#include "string_table_p.hpp"
 
 #include "cocaine/traits/dynamic.hpp"
 
@@ -60,7 +62,7 @@ public:
 		struct groupset_info_t;
 		struct couple_info_t;
 
-		typedef std::map<int, group_info_t> group_info_map_t;
+		typedef group_table_t<group_info_t> group_info_map_t;
 		typedef std::map<std::string, groupset_info_t> groupset_info_map_t;
 		typedef std::map<std::string, couple_info_t> couple_info_map_t;
 
@@ -98,9 +100,12 @@ public:
 			uint64_t free_reserved_space;
 
 			kora::dynamic_t hosts;
+			std::vector<host_t> host_infos;
 			kora::dynamic_t settings;
 		};
 
+		typedef host_t host_info_t;
+
 		struct couple_info_t {
 			enum class status_tag {
 				UNKNOWN, BAD
@@ -114,19 +119,48 @@ public:
 			uint64_t free_reserved_space;
 
 			kora::dynamic_t hosts;
+			std::vector<host_info_t> host_infos;
+			// Hosts are numbered per snapshot
+			std::vector<size_t> host_ids;
+			// Groups ordered by the locality of the client
+			groups_t read_groups;
 
 			std::vector<group_info_map_iterator_t> groups_info_map_iterator;
 
 			groupset_info_map_t groupset_info_map;
-			std::vector<std::string> read_preference;
+			// Indexes of lists in strings
+			size_t read_preference;
+			size_t groupset_ids;
 		};
 
-		couples_t(const kora::config_t &config);
+		couples_t(const kora::config_t &config, const locality_t &locality);
 
 		couples_t(couples_t &&other);
 
+		// Mastermind describes a host as an object with host, port, family and dc
+		// fields. The group of a host is given by its group_id field or by a key of
+		// an enclosing object, so hosts are looked for at any depth.
+		static
+		void
+		collect_hosts(const kora::dynamic_t &dynamic, group_t group
+				, std::vector<host_info_t> &hosts);
+
+		// Groups with lower rank are read first
+		static
+		int
+		locality_rank(group_t group, const std::vector<host_info_t> &hosts
+				, const locality_t &locality);
+
 		group_info_map_t group_info_map;
 		couple_info_map_t couple_info_map;
+
+		// Groupset ids and read preferences of all couples
+		string_table_t strings;
+		// The list of "replicas" only, it is used when mastermind gives no list
+		size_t default_read_preference;
+
+		// Couples sorted by free effective space in descending order
+		std::vector<couple_space_t> free_space_index;
 	};
 
 	struct statistics_t {
@@ -145,18 +179,27 @@ public:
 	};*/
 
 	data_t(std::string name, const kora::config_t &config
-			, const user_settings_factory_t &factory);
+			, const user_settings_factory_t &factory, const locality_t &locality);
 
 	data_t(data_t &&other);
 
 	void check_consistency();
 
+	// Host ids of couples indexed as weights.data()
+	typedef std::vector<const std::vector<size_t> *> couples_hosts_t;
+
+	static
+	couples_hosts_t
+	create_couples_hosts(const couples_t &couples
+			, const ns_state::weight::weights_t &weights);
+
 	std::string name;
 
 	settings_t settings;
 	couples_t couples;
 	ns_state::weight::weights_t weights;
 	statistics_t statistics;
+	couples_hosts_t couples_hosts;
 
 	std::string extract;
 };
@@ -168,7 +211,7 @@ public:
 
 	struct data_t : namespace_state_t::data_t {
 		data_t(std::string name, const kora::config_t &config
-				, const user_settings_factory_t &factory);
+				, const user_settings_factory_t &factory, const locality_t &locality);
 
 		data_t(data_t &&other);
 	};
@@ -19,9 +19,20 @@
 
 #include "namespace_state_p.hpp"
 #include "couple_sequence_p.hpp"
+#include "random_p.hpp"
+
+#include <boost/algorithm/string/predicate.hpp>
 
 namespace mastermind {
 
+namespace {
+
+// Max number of weighted draws of couples without a usable groupset
+// before all couples are checked
+const size_t GROUPSET_ATTEMPTS = 8;
+
+} // namespace
+
 size_t
 namespace_state_t::settings_t::groups_count() const {
 	return namespace_state.data->settings.groups_count;
@@ -101,16 +112,23 @@ namespace_state_t::groupset_t::settings() const {
 	return data.settings;
 }
 
+span_t<namespace_state_t::host_t>
+namespace_state_t::groupset_t::host_list() const {
+	return {data.host_infos.data(), data.host_infos.size()};
+}
+
 std::vector<std::string>
 namespace_state_t::couples_t::get_couple_read_preference(group_t group) const {
-	auto it = namespace_state.data->couples.group_info_map.find(group);
+	auto ids = get_couple_read_preference_view(group);
 
-	if (it == namespace_state.data->couples.group_info_map.end() ||
-		it->second.couple_info_map_iterator->second.read_preference.empty()) {
-		return {"replicas"};
+	std::vector<std::string> read_preference;
+	read_preference.reserve(ids.size());
+
+	for (auto it = ids.begin(), end = ids.end(); it != end; ++it) {
+		read_preference.emplace_back(get_string(*it));
 	}
 
-	return it->second.couple_info_map_iterator->second.read_preference;
+	return read_preference;
 }
 
 namespace_state_t::groupset_t
@@ -132,50 +150,100 @@ namespace_state_t::couples_t::get_couple_groupset(group_t group, const std::stri
 
 std::vector<std::string>
 namespace_state_t::couples_t::get_couple_groupset_ids(group_t group) const {
-	auto cit = namespace_state.data->couples.group_info_map.find(group);
+	auto ids = get_couple_groupset_ids_view(group);
 
-	if (cit == namespace_state.data->couples.group_info_map.end()) {
-		throw unknown_group_error{group};
+	std::vector<std::string> groupset_ids;
+	groupset_ids.reserve(ids.size());
+
+	for (auto it = ids.begin(), end = ids.end(); it != end; ++it) {
+		groupset_ids.emplace_back(get_string(*it));
 	}
 
-	const auto & map = cit->second.couple_info_map_iterator->second.groupset_info_map;
+	return groupset_ids;
+}
 
-	std::vector<std::string> groupset_ids;
+span_t<namespace_state_t::string_id_t>
+namespace_state_t::couples_t::get_couple_read_preference_view(group_t group) const {
+	const auto &couples = namespace_state.data->couples;
+	auto it = couples.group_info_map.find(group);
 
-	for (auto it = map.begin(); it != map.end(); it++) {
-		groupset_ids.emplace_back(it->first);
+	if (it == couples.group_info_map.end()) {
+		return couples.strings.list(couples.default_read_preference);
 	}
 
-	// TODO: remove when "replicas" becomes a separate groupset in 'groupset_info_map'
-	{
-		auto it = find(groupset_ids.begin(), groupset_ids.end(), "replicas");
-		if (it == groupset_ids.end()) {
-			groupset_ids.emplace_back("replicas");
-		}
+	return couples.strings.list(it->second.couple_info_map_iterator->second.read_preference);
+}
+
+span_t<namespace_state_t::string_id_t>
+namespace_state_t::couples_t::get_couple_groupset_ids_view(group_t group) const {
+	const auto &couples = namespace_state.data->couples;
+	auto it = couples.group_info_map.find(group);
+
+	if (it == couples.group_info_map.end()) {
+		throw unknown_group_error{group};
 	}
 
-	return groupset_ids;
+	return couples.strings.list(it->second.couple_info_map_iterator->second.groupset_ids);
+}
+
+const std::string &
+namespace_state_t::couples_t::get_string(string_id_t id) const {
+	return namespace_state.data->couples.strings.get(id);
 }
 
 groups_t
 namespace_state_t::couples_t::get_couple_groups(group_t group) const {
+	auto groups = get_couple_groups_view(group);
+	return groups_t(groups.begin(), groups.end());
+}
+
+groups_t
+namespace_state_t::couples_t::get_groups(group_t group) const {
+	groups_t groups;
+	get_groups(group, groups);
+	return groups;
+}
+
+groups_t
+namespace_state_t::couples_t::get_couple_read_groups(group_t group) const {
+	auto groups = get_couple_read_groups_view(group);
+	return groups_t(groups.begin(), groups.end());
+}
+
+span_t<group_t>
+namespace_state_t::couples_t::get_couple_groups_view(group_t group) const {
 	auto it = namespace_state.data->couples.group_info_map.find(group);
 
 	if (it == namespace_state.data->couples.group_info_map.end()) {
-		return groups_t();
+		return {};
 	}
 
-	return it->second.couple_info_map_iterator->second.groups;
+	const auto &groups = it->second.couple_info_map_iterator->second.groups;
+	return {groups.data(), groups.size()};
 }
 
-groups_t
-namespace_state_t::couples_t::get_groups(group_t group) const {
-	auto groups = get_couple_groups(group);
+span_t<group_t>
+namespace_state_t::couples_t::get_couple_read_groups_view(group_t group) const {
+	auto it = namespace_state.data->couples.group_info_map.find(group);
+
+	if (it == namespace_state.data->couples.group_info_map.end()) {
+		return {};
+	}
+
+	const auto &read_groups = it->second.couple_info_map_iterator->second.read_groups;
+	return {read_groups.data(), read_groups.size()};
+}
+
+void
+namespace_state_t::couples_t::get_groups(group_t group, groups_t &result) const {
+	auto groups = get_couple_groups_view(group);
 
 	if (groups.empty()) {
-		return {group};
+		result.assign(1, group);
+		return;
 	}
-	return groups;
+
+	result.assign(groups.begin(), groups.end());
 }
 
 uint64_t
@@ -186,7 +254,30 @@ namespace_state_t::couples_t::free_effective_space(group_t group) const {
 		return 0;
 	}
 
-	return it->second.couple_info_map_iterator->second.free_effective_space;
+	auto free_effective_space = it->second.couple_info_map_iterator->second.free_effective_space;
+	auto committed_memory = namespace_state.data->weights.committed_memory(group);
+
+	return free_effective_space > committed_memory
+		? free_effective_space - committed_memory : 0;
+}
+
+span_t<namespace_state_t::couple_space_t>
+namespace_state_t::couples_t::get_couples_by_free_space(size_t count) const {
+	const auto &free_space_index = namespace_state.data->couples.free_space_index;
+
+	return {free_space_index.data(), std::min(count, free_space_index.size())};
+}
+
+span_t<namespace_state_t::couple_space_t>
+namespace_state_t::couples_t::get_couples_with_free_space(uint64_t free_space) const {
+	const auto &free_space_index = namespace_state.data->couples.free_space_index;
+
+	auto end = std::partition_point(free_space_index.begin(), free_space_index.end()
+			, [free_space] (const couple_space_t &couple_space) {
+				return couple_space.free_effective_space > free_space;
+			});
+
+	return {free_space_index.data(), size_t(end - free_space_index.begin())};
 }
 
 uint64_t
@@ -211,6 +302,18 @@ namespace_state_t::couples_t::hosts(group_t group) const {
 	return it->second.couple_info_map_iterator->second.hosts;
 }
 
+span_t<namespace_state_t::host_t>
+namespace_state_t::couples_t::get_couple_hosts(group_t group) const {
+	auto it = namespace_state.data->couples.group_info_map.find(group);
+
+	if (it == namespace_state.data->couples.group_info_map.end()) {
+		throw unknown_group_error{group};
+	}
+
+	const auto &host_infos = it->second.couple_info_map_iterator->second.host_infos;
+	return {host_infos.data(), host_infos.size()};
+}
+
 namespace_state_t::couples_t::couples_t(const namespace_state_t &namespace_state_)
 	: namespace_state(namespace_state_)
 {
@@ -221,10 +324,152 @@ namespace_state_t::weights_t::groups(uint64_t size) const {
 	return namespace_state.data->weights.get(size).groups;
 }
 
+span_t<group_t>
+namespace_state_t::weights_t::groups_view(uint64_t size) const {
+	return namespace_state.data->weights.get_groups(size);
+}
+
+size_t
+namespace_state_t::weights_t::groups(uint64_t size, size_t count, bool replacement
+		, std::vector<groups_t> &result) const {
+	return namespace_state.data->weights.get(size, count, replacement, result);
+}
+
+groups_t
+namespace_state_t::weights_t::groups_by_key(uint64_t key_hash, uint64_t size) const {
+	return namespace_state.data->weights.get_by_key(key_hash, size).groups;
+}
+
+std::pair<groups_t, namespace_state_t::groupset_t>
+namespace_state_t::weights_t::groups_with_groupset(uint64_t size
+		, const std::string &groupset_type) const {
+	typedef namespace_state_t::data_t::couples_t::groupset_info_t groupset_info_t;
+
+	const auto &couples = namespace_state.data->couples;
+	const auto &weights = namespace_state.data->weights;
+
+	// Names are the ones groupset_t::type() returns
+	groupset_info_t::type_tag type;
+
+	if (boost::algorithm::iequals(groupset_type, "lrc")) {
+		type = groupset_info_t::type_tag::LRC;
+	} else if (boost::algorithm::iequals(groupset_type, "UNKNOWN")) {
+		type = groupset_info_t::type_tag::UNKNOWN;
+	} else {
+		throw unknown_groupset_type_error(groupset_type);
+	}
+
+	auto find_groupset = [&] (group_t couple_id) -> const groupset_info_t * {
+		auto it = couples.group_info_map.find(couple_id);
+
+		if (it == couples.group_info_map.end()) {
+			return 0;
+		}
+
+		const auto &groupset_info_map
+			= it->second.couple_info_map_iterator->second.groupset_info_map;
+
+		for (auto git = groupset_info_map.begin(), gend = groupset_info_map.end();
+				git != gend; ++git) {
+			const auto &groupset_info = git->second;
+
+			if (groupset_info.status != groupset_info_t::status_tag::BAD
+					&& groupset_info.free_effective_space >= size
+					&& groupset_info.type == type) {
+				return &groupset_info;
+			}
+		}
+
+		return 0;
+	};
+
+	auto make_result = [] (groups_t groups, const groupset_info_t &groupset_info) {
+		return std::make_pair(std::move(groups)
+				, groupset_t(static_cast<const groupset_t::data_t &>(groupset_info)));
+	};
+
+	// Groupsets keep their own free space, so the memory of the whole couple
+	// is not checked and couples are drawn without a size
+	for (size_t attempt = 0; attempt != GROUPSET_ATTEMPTS; ++attempt) {
+		auto couple_info = weights.get(0);
+
+		if (auto groupset_info = find_groupset(couple_info.id)) {
+			return make_result(std::move(couple_info.groups), *groupset_info);
+		}
+	}
+
+	// Most of the weight belongs to couples without a usable groupset
+	auto weighted_couples_info = weights.get_all(0);
+
+	ns_state::weight::weighted_couples_info_t candidates;
+	std::vector<const groupset_info_t *> candidates_groupsets;
+	uint64_t previous_weight = 0;
+	uint64_t total_weight = 0;
+
+	for (auto it = weighted_couples_info.begin(), end = weighted_couples_info.end();
+			it != end; ++it) {
+		auto weight = it->weight - previous_weight;
+		previous_weight = it->weight;
+
+		if (auto groupset_info = find_groupset(weights.data().id(it->index))) {
+			total_weight += weight;
+			candidates.emplace_back(total_weight, it->index);
+			candidates_groupsets.emplace_back(groupset_info);
+		}
+	}
+
+	if (candidates.empty()) {
+		throw not_enough_memory_error();
+	}
+
+	auto shoot_point = std::min(total_weight - 1, uint64_t(random_uniform() * total_weight));
+	auto it = std::upper_bound(candidates.begin(), candidates.end(), shoot_point
+			, [] (uint64_t value, const ns_state::weight::weighted_couple_info_t &candidate) {
+				return value < candidate.weight;
+			});
+
+	auto groups = weights.data().groups(it->index);
+
+	return make_result(groups_t(groups.begin(), groups.end())
+			, *candidates_groupsets[it - candidates.begin()]);
+}
+
+std::vector<groups_t>
+namespace_state_t::weights_t::plan_multipart(uint64_t content_length
+		, uint64_t part_size) const {
+	return namespace_state.data->weights.plan(content_length, part_size);
+}
+
 couple_sequence_t
 namespace_state_t::weights_t::couple_sequence(uint64_t size) const {
+	const auto &weights = namespace_state.data->weights;
+
 	auto data = std::make_shared<couple_sequence_init_t::data_t>(
-			namespace_state.data->weights.get_all(size));
+			weights.data(), weights.get_all(size));
+	return couple_sequence_init_t(std::move(data));
+}
+
+couple_sequence_t
+namespace_state_t::weights_t::couple_sequence(uint64_t size, bool avoid_shared_hosts) const {
+	if (!avoid_shared_hosts) {
+		return couple_sequence(size);
+	}
+
+	const auto &weights = namespace_state.data->weights;
+	const auto &couples_hosts = namespace_state.data->couples_hosts;
+
+	auto weighted_couples_info = weights.get_all(size);
+
+	auto hosts = std::make_shared<couple_sequence_init_t::data_t::hosts_t>();
+	hosts->reserve(weighted_couples_info.size());
+
+	for (auto it = weighted_couples_info.begin(), end = weighted_couples_info.end();
+			it != end; ++it) {
+		hosts->emplace_back(couples_hosts[it->index]);
+	}
+
+	auto data = std::make_shared<couple_sequence_init_t::data_t>(
+			weights.data(), weighted_couples_info, std::move(hosts));
 	return couple_sequence_init_t(std::move(data));
 }
 
@@ -233,7 +478,7 @@ namespace_state_t::weights_t::set_feedback(group_t couple_id
 		, feedback_tag feedback) {
 	switch (feedback) {
 	case feedback_tag::available:
-		namespace_state.data->weights.set_coefficient(couple_id, 1);
+		namespace_state.data->weights.recover_coefficient(couple_id);
 		break;
 	case feedback_tag::partly_unavailable:
 		namespace_state.data->weights.set_coefficient(couple_id, 0.1);
@@ -250,6 +495,37 @@ namespace_state_t::weights_t::set_feedback(group_t couple_id
 
 }
 
+void
+namespace_state_t::weights_t::set_feedback(group_t couple_id
+		, std::chrono::microseconds latency, uint64_t size) {
+	namespace_state.data->weights.add_latency(couple_id, latency, size);
+}
+
+void
+namespace_state_t::weights_t::reserve(group_t couple_id, uint64_t size) {
+	namespace_state.data->weights.reserve(couple_id, size);
+}
+
+void
+namespace_state_t::weights_t::release(group_t couple_id, uint64_t size) {
+	namespace_state.data->weights.release(couple_id, size);
+}
+
+void
+namespace_state_t::weights_t::commit(group_t couple_id, uint64_t size) {
+	namespace_state.data->weights.commit(couple_id, size);
+}
+
+void
+namespace_state_t::weights_t::set_selection_mode(selection_mode_tag selection_mode) {
+	namespace_state.data->weights.set_selection_mode(selection_mode);
+}
+
+void
+namespace_state_t::weights_t::set_feedback_half_life(std::chrono::milliseconds half_life) {
+	namespace_state.data->weights.set_feedback_half_life(half_life);
+}
+
 namespace_state_t::weights_t::weights_t(const namespace_state_t &namespace_state_)
 	: namespace_state(namespace_state_)
 {
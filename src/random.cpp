@@ -0,0 +1,190 @@
+/*
+	Client library for mastermind
+	Copyright (C) 2013-2015 Yandex
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "random_p.hpp"
+
+#include <boost/thread/tss.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <random>
+
+namespace mastermind {
+
+namespace {
+
+class default_random_generator_t : public random_generator_t {
+public:
+	default_random_generator_t(uint64_t seed)
+		: engine(seed)
+	{}
+
+	uint64_t
+	operator () () {
+		return engine();
+	}
+
+private:
+	std::mt19937_64 engine;
+};
+
+struct settings_t {
+	settings_t()
+		: generation(1)
+		, has_seed(false)
+		, seed(0)
+		, threads_count(0)
+	{}
+
+	// Is changed by every setter to make threads recreate their generators
+	std::atomic<uint64_t> generation;
+
+	std::mutex mutex;
+	random_generator_factory_t factory;
+	bool has_seed;
+	uint64_t seed;
+	uint64_t threads_count;
+};
+
+settings_t &
+settings() {
+	static settings_t instance;
+	return instance;
+}
+
+struct thread_generator_t {
+	thread_generator_t()
+		: generation(0)
+	{}
+
+	uint64_t generation;
+	random_generator_ptr_t generator;
+};
+
+// thread_local is not supported by all compilers the library is built with
+boost::thread_specific_ptr<thread_generator_t> thread_generators;
+
+random_generator_t &
+get_thread_generator() {
+	auto *thread_generator = thread_generators.get();
+
+	if (!thread_generator) {
+		thread_generator = new thread_generator_t;
+		thread_generators.reset(thread_generator);
+	}
+
+	auto &s = settings();
+	auto generation = s.generation.load(std::memory_order_acquire);
+
+	if (thread_generator->generation == generation) {
+		return *thread_generator->generator;
+	}
+
+	random_generator_factory_t factory;
+	uint64_t seed = 0;
+
+	{
+		std::lock_guard<std::mutex> lock_guard(s.mutex);
+		(void) lock_guard;
+
+		generation = s.generation.load(std::memory_order_acquire);
+		factory = s.factory;
+
+		if (s.has_seed) {
+			seed = mix(s.seed + s.threads_count++);
+		} else {
+			std::random_device random_device;
+			seed = (uint64_t(random_device()) << 32) | random_device();
+		}
+	}
+
+	random_generator_ptr_t generator;
+
+	if (factory) {
+		generator = factory(seed);
+	}
+
+	if (!generator) {
+		generator.reset(new default_random_generator_t(seed));
+	}
+
+	thread_generator->generator = std::move(generator);
+	thread_generator->generation = generation;
+
+	return *thread_generator->generator;
+}
+
+} // namespace
+
+random_generator_t::~random_generator_t() {
+}
+
+void
+set_random_generator_factory(random_generator_factory_t factory) {
+	auto &s = settings();
+	std::lock_guard<std::mutex> lock_guard(s.mutex);
+	(void) lock_guard;
+
+	s.factory = std::move(factory);
+	s.threads_count = 0;
+	s.generation += 1;
+}
+
+void
+set_random_seed(uint64_t seed) {
+	auto &s = settings();
+	std::lock_guard<std::mutex> lock_guard(s.mutex);
+	(void) lock_guard;
+
+	s.has_seed = true;
+	s.seed = seed;
+	s.threads_count = 0;
+	s.generation += 1;
+}
+
+void
+reset_random_seed() {
+	auto &s = settings();
+	std::lock_guard<std::mutex> lock_guard(s.mutex);
+	(void) lock_guard;
+
+	s.has_seed = false;
+	s.generation += 1;
+}
+
+uint64_t
+mix(uint64_t value) {
+	value += 0x9e3779b97f4a7c15ULL;
+	value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+	return value ^ (value >> 31);
+}
+
+uint64_t
+random_value() {
+	return get_thread_generator()();
+}
+
+double
+random_uniform() {
+	// 53 high bits fill the mantissa of double exactly
+	return (random_value() >> 11) * (1.0 / (uint64_t(1) << 53));
+}
+
+} // namespace mastermind
@@ -0,0 +1,42 @@
+/*
+	Client library for mastermind
+	Copyright (C) 2013-2015 Yandex
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef LIBMASTERMIND__SRC__RANDOM_P__HPP
+#define LIBMASTERMIND__SRC__RANDOM_P__HPP
+
+#include "libmastermind/random.hpp"
+
+namespace mastermind {
+
+// Both functions use the generator of the calling thread
+
+uint64_t
+random_value();
+
+// Returns a uniformly distributed value in [0, 1)
+double
+random_uniform();
+
+// splitmix64 finalizer, spreads close values over the whole range
+uint64_t
+mix(uint64_t value);
+
+} // namespace mastermind
+
+#endif /* LIBMASTERMIND__SRC__RANDOM_P__HPP */
@@ -0,0 +1,84 @@
+/*
+	Client library for mastermind
+	Copyright (C) 2013-2015 Yandex
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef LIBMASTERMIND__SRC__STRING_TABLE_P__HPP
+#define LIBMASTERMIND__SRC__STRING_TABLE_P__HPP
+
+#include "libmastermind/common.hpp"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace mastermind {
+
+// Strings and lists of strings interned once per snapshot. Equal strings get
+// the same id and equal lists are kept once, so couples refer to a list by
+// its index and readers get views without copies.
+class string_table_t {
+public:
+	typedef uint32_t id_t;
+	typedef std::vector<id_t> ids_t;
+
+	id_t
+	intern(const std::string &string) {
+		auto insert_result = string_ids.insert(std::make_pair(string, id_t(strings.size())));
+
+		if (insert_result.second) {
+			strings.emplace_back(string);
+		}
+
+		return insert_result.first->second;
+	}
+
+	// Returns the index of the list
+	size_t
+	intern(const ids_t &list) {
+		auto insert_result = list_indexes.insert(std::make_pair(list, lists.size()));
+
+		if (insert_result.second) {
+			lists.emplace_back(list);
+		}
+
+		return insert_result.first->second;
+	}
+
+	const std::string &
+	get(id_t id) const {
+		return strings.at(id);
+	}
+
+	span_t<id_t>
+	list(size_t index) const {
+		const auto &ids = lists[index];
+		return {ids.data(), ids.size()};
+	}
+
+private:
+	std::vector<std::string> strings;
+	std::map<std::string, id_t> string_ids;
+
+	std::vector<ids_t> lists;
+	std::map<ids_t, size_t> list_indexes;
+};
+
+} // namespace mastermind
+
+#endif /* LIBMASTERMIND__SRC__STRING_TABLE_P__HPP */
@@ -0,0 +1,532 @@
+#include "couple_weights_p.hpp"
+#include "couple_sequence_p.hpp"
+
+#include "libmastermind/error.hpp"
+#include "libmastermind/random.hpp"
+
+#include <kora/dynamic.hpp>
+#include <kora/config.hpp>
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+
+#include <limits>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace mastermind;
+using namespace mastermind::ns_state::weight;
+
+namespace {
+
+// Couples are of two groups, weights and memories are indexed as couples
+kora::config_t
+create_config(const std::vector<groups_t> &couples
+		, const std::vector<uint64_t> &weights, const std::vector<uint64_t> &memories) {
+	kora::dynamic_t::array_t dynamic_couples;
+
+	for (size_t index = 0; index != couples.size(); ++index) {
+		const auto &groups = couples[index];
+		kora::dynamic_t::array_t dynamic_groups;
+
+		for (auto it = groups.begin(), end = groups.end(); it != end; ++it) {
+			dynamic_groups.emplace_back(*it);
+		}
+
+		kora::dynamic_t::array_t dynamic_couple;
+		dynamic_couple.emplace_back(dynamic_groups);
+		dynamic_couple.emplace_back(weights[index]);
+		dynamic_couple.emplace_back(memories[index]);
+
+		dynamic_couples.emplace_back(dynamic_couple);
+	}
+
+	kora::dynamic_t::object_t dynamic_weights;
+	dynamic_weights["2"] = dynamic_couples;
+
+	return kora::config_t("weights", dynamic_weights);
+}
+
+// Every couple gets the same weight and memory
+kora::config_t
+create_config(const std::vector<groups_t> &couples) {
+	return create_config(couples, std::vector<uint64_t>(couples.size(), 100)
+			, std::vector<uint64_t>(couples.size(), 1000));
+}
+
+// Couple i has groups 2i + 1 and 2i + 2, its id is 2i + 1
+std::vector<groups_t>
+create_couples(size_t count) {
+	std::vector<groups_t> result;
+
+	for (size_t index = 0; index != count; ++index) {
+		result.push_back({group_t(2 * index + 1), group_t(2 * index + 2)});
+	}
+
+	return result;
+}
+
+// Selects count couples and returns the share of every couple id
+std::map<group_t, double>
+selection_shares(const weights_t &weights, uint64_t size, size_t count) {
+	std::map<group_t, double> result;
+
+	for (size_t index = 0; index != count; ++index) {
+		result[weights.get(size).id] += 1. / count;
+	}
+
+	return result;
+}
+
+// Without hosts the sequence does not avoid shared hosts
+std::vector<group_t>
+draw_sequence(const weights_t &weights
+		, std::shared_ptr<const couple_sequence_init_t::data_t::hosts_t> hosts
+			= std::shared_ptr<const couple_sequence_init_t::data_t::hosts_t>()) {
+	couple_sequence_t sequence = couple_sequence_init_t(
+			std::make_shared<couple_sequence_init_t::data_t>(
+				weights.data(), weights.get_all(0), std::move(hosts)));
+
+	std::vector<group_t> result;
+
+	for (auto it = sequence.begin(), end = sequence.end(); it != end; ++it) {
+		result.push_back(it->id);
+	}
+
+	return result;
+}
+
+// Always returns the max value
+class max_random_generator_t : public random_generator_t {
+public:
+	uint64_t
+	operator () () {
+		return std::numeric_limits<uint64_t>::max();
+	}
+};
+
+// Counts parts of the plan by couple id
+std::map<group_t, size_t>
+count_parts(const std::vector<groups_t> &plan) {
+	std::map<group_t, size_t> result;
+
+	for (auto it = plan.begin(), end = plan.end(); it != end; ++it) {
+		result[it->front()] += 1;
+	}
+
+	return result;
+}
+
+// Tells whether the couple is selected in count attempts
+bool
+is_selected(const weights_t &weights, group_t couple_id, size_t count = 1000) {
+	for (size_t index = 0; index != count; ++index) {
+		if (weights.get(0).id == couple_id) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Counts how many times the couple is selected in count attempts
+size_t
+count_selected(const weights_t &weights, group_t couple_id, size_t count) {
+	size_t result = 0;
+
+	for (size_t index = 0; index != count; ++index) {
+		if (weights.get(0).id == couple_id) {
+			result += 1;
+		}
+	}
+
+	return result;
+}
+
+} // namespace
+
+class couple_weights_tests_t : public CppUnit::TestFixture {
+	CPPUNIT_TEST_SUITE(couple_weights_tests_t);
+	CPPUNIT_TEST(refresh_restores_unavailable_couple);
+	CPPUNIT_TEST(key_keeps_couple_under_feedback);
+	CPPUNIT_TEST(refresh_keeps_reservations);
+	CPPUNIT_TEST(available_starts_recovery);
+	CPPUNIT_TEST(sequence_copies_iterate_from_threads);
+	CPPUNIT_TEST(alias_table_follows_weights);
+	CPPUNIT_TEST(fenwick_tree_finds_and_removes);
+	CPPUNIT_TEST(selection_follows_weights_and_coefficients);
+	CPPUNIT_TEST(selection_with_size_follows_weights);
+	CPPUNIT_TEST(batch_without_replacement_yields_distinct_couples);
+	CPPUNIT_TEST(batch_keeps_buffer_memory);
+	CPPUNIT_TEST(sequence_follows_weights);
+	CPPUNIT_TEST(sequence_avoids_shared_hosts);
+	CPPUNIT_TEST(plan_has_part_for_every_part_size);
+	CPPUNIT_TEST(plan_spreads_parts_by_weight);
+	CPPUNIT_TEST(plan_keeps_parts_within_memory);
+	CPPUNIT_TEST(plan_throws_without_memory);
+	CPPUNIT_TEST(plan_rounding_keeps_last_couple_within_memory);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {
+		set_random_seed(42);
+	}
+
+	void tearDown() {
+		set_random_generator_factory(random_generator_factory_t());
+		reset_random_seed();
+	}
+
+	void refresh_restores_unavailable_couple() {
+		auto config = create_config({{1, 2}, {3, 4}});
+
+		weights_t old_weights(config, 2, false);
+		old_weights.set_coefficient(1, 0);
+		CPPUNIT_ASSERT(!is_selected(old_weights, 1));
+
+		weights_t new_weights(config, 2, false);
+		new_weights.inherit_feedback(old_weights);
+		CPPUNIT_ASSERT(is_selected(new_weights, 1));
+	}
+
+	void key_keeps_couple_under_feedback() {
+		weights_t weights(create_config({{1, 2}, {3, 4}, {5, 6}, {7, 8}}), 2, false);
+
+		std::vector<group_t> couples;
+
+		for (uint64_t key = 0; key != 100; ++key) {
+			couples.emplace_back(weights.get_by_key(key, 0).id);
+		}
+
+		weights.set_coefficient(1, 0.1);
+		weights.add_latency(3, std::chrono::seconds(1), 1);
+		weights.reserve(5, 500);
+
+		for (uint64_t key = 0; key != 100; ++key) {
+			CPPUNIT_ASSERT_EQUAL(couples[key], weights.get_by_key(key, 0).id);
+		}
+
+		weights.set_coefficient(1, 0);
+
+		for (uint64_t key = 0; key != 100; ++key) {
+			auto couple_id = weights.get_by_key(key, 0).id;
+
+			CPPUNIT_ASSERT(couple_id != 1);
+			CPPUNIT_ASSERT(couples[key] == 1 || couples[key] == couple_id);
+		}
+	}
+
+	void refresh_keeps_reservations() {
+		auto config = create_config({{1, 2}, {3, 4}});
+
+		weights_t old_weights(config, 2, false);
+		old_weights.reserve(1, 1000);
+
+		weights_t new_weights(config, 2, false);
+		new_weights.inherit_feedback(old_weights);
+		CPPUNIT_ASSERT(!is_selected(new_weights, 1));
+
+		// The upload is released in the state it was reserved in
+		old_weights.release(1, 1000);
+		CPPUNIT_ASSERT(is_selected(new_weights, 1));
+	}
+
+	void available_starts_recovery() {
+		weights_t weights(create_config({{1, 2}, {3, 4}}), 2, false);
+
+		weights.set_coefficient(1, 0);
+		CPPUNIT_ASSERT(!is_selected(weights, 1));
+
+		// The couple gets a small share of its traffic back, not the whole of it
+		weights.recover_coefficient(1);
+		auto selected = count_selected(weights, 1, 10000);
+		CPPUNIT_ASSERT(selected != 0);
+		CPPUNIT_ASSERT(selected < 1000);
+
+		// Every report doubles the coefficient
+		weights.recover_coefficient(1);
+		CPPUNIT_ASSERT(count_selected(weights, 1, 10000) > selected);
+	}
+
+	void sequence_copies_iterate_from_threads() {
+		auto couples = create_couples(50);
+		weights_t weights(create_config(couples), 2, false);
+		couple_sequence_t sequence = couple_sequence_init_t(
+				std::make_shared<couple_sequence_init_t::data_t>(
+					weights.data(), weights.get_all(0)));
+
+		auto it = sequence.begin();
+		std::vector<std::vector<group_t>> results(4);
+		std::vector<std::thread> threads;
+
+		for (size_t index = 0; index != results.size(); ++index) {
+			auto &result = results[index];
+			auto copy = it;
+
+			threads.emplace_back([copy, &result, &sequence] () mutable {
+				for (; copy != sequence.end(); ++copy) {
+					result.push_back(copy->id);
+				}
+			});
+		}
+
+		for (auto it = threads.begin(), end = threads.end(); it != end; ++it) {
+			it->join();
+		}
+
+		// Copies yield the same couples whichever of them draws a couple first
+		CPPUNIT_ASSERT_EQUAL(couples.size(), results[0].size());
+
+		for (size_t index = 1; index != results.size(); ++index) {
+			CPPUNIT_ASSERT(results[0] == results[index]);
+		}
+	}
+
+	void alias_table_follows_weights() {
+		alias_table_t table({100, 0, 300, 600});
+		std::vector<double> shares(4);
+		const size_t count = 100000;
+
+		for (size_t index = 0; index != count; ++index) {
+			shares[table.get(random_uniform())] += 1. / count;
+		}
+
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(0.1, shares[0], 0.01);
+		CPPUNIT_ASSERT_EQUAL(0., shares[1]);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(0.3, shares[2], 0.01);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(0.6, shares[3], 0.01);
+	}
+
+	void fenwick_tree_finds_and_removes() {
+		fenwick_tree_t tree({1, 0, 3, 2, 4});
+
+		CPPUNIT_ASSERT_EQUAL(uint64_t(10), tree.total_weight());
+		CPPUNIT_ASSERT_EQUAL(size_t(0), tree.get(0));
+		CPPUNIT_ASSERT_EQUAL(size_t(2), tree.get(1));
+		CPPUNIT_ASSERT_EQUAL(size_t(2), tree.get(3));
+		CPPUNIT_ASSERT_EQUAL(size_t(3), tree.get(4));
+		CPPUNIT_ASSERT_EQUAL(size_t(4), tree.get(9));
+
+		tree.remove(2);
+
+		CPPUNIT_ASSERT_EQUAL(uint64_t(7), tree.total_weight());
+		CPPUNIT_ASSERT_EQUAL(uint64_t(0), tree.weight(2));
+		CPPUNIT_ASSERT_EQUAL(size_t(3), tree.get(1));
+		CPPUNIT_ASSERT_EQUAL(size_t(4), tree.get(3));
+	}
+
+	void selection_follows_weights_and_coefficients() {
+		weights_t weights(create_config(create_couples(4)
+					, {100, 200, 300, 400}, {1000, 1000, 1000, 1000}), 2, false);
+
+		// Coefficients do not recover during the test
+		weights.set_feedback_half_life(std::chrono::milliseconds(0));
+		weights.set_coefficient(3, 0.5);
+		weights.set_coefficient(7, 0.25);
+
+		// Shares are proportional to 100, 100, 300 and 100
+		const weights_t::selection_mode_tag modes[] = {
+			weights_t::selection_mode_tag::alias, weights_t::selection_mode_tag::linear};
+
+		for (size_t index = 0; index != 2; ++index) {
+			weights.set_selection_mode(modes[index]);
+			auto shares = selection_shares(weights, 0, 100000);
+
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 6, shares[1], 0.01);
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 6, shares[3], 0.01);
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 2, shares[5], 0.01);
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 6, shares[7], 0.01);
+		}
+	}
+
+	void selection_with_size_follows_weights() {
+		weights_t weights(create_config(create_couples(4)
+					, {100, 200, 300, 400}, {4000, 3000, 2000, 1000}), 2, false);
+
+		weights.set_feedback_half_life(std::chrono::milliseconds(0));
+
+		// Only the first two couples fit the size
+		auto shares = selection_shares(weights, 2500, 100000);
+
+		CPPUNIT_ASSERT_EQUAL(size_t(2), shares.size());
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 3, shares[1], 0.01);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(2. / 3, shares[3], 0.01);
+
+		// The penalty is applied to couples which fit the size only
+		weights.set_coefficient(3, 0.5);
+		shares = selection_shares(weights, 2500, 100000);
+
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 2, shares[1], 0.01);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 2, shares[3], 0.01);
+
+		CPPUNIT_ASSERT_THROW(weights.get(5000), not_enough_memory_error);
+	}
+
+	void batch_without_replacement_yields_distinct_couples() {
+		weights_t weights(create_config(create_couples(4)
+					, {100, 200, 300, 400}, {1000, 1000, 1000, 1000}), 2, false);
+
+		std::vector<groups_t> result;
+		std::map<group_t, double> first_shares;
+		const size_t count = 10000;
+
+		for (size_t index = 0; index != count; ++index) {
+			CPPUNIT_ASSERT_EQUAL(size_t(3), weights.get(0, 3, false, result));
+
+			std::set<group_t> couples;
+
+			for (auto it = result.begin(), end = result.end(); it != end; ++it) {
+				couples.insert(it->front());
+			}
+
+			CPPUNIT_ASSERT_EQUAL(size_t(3), couples.size());
+			first_shares[result.front().front()] += 1. / count;
+		}
+
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(0.1, first_shares[1], 0.02);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(0.4, first_shares[7], 0.02);
+
+		// There are less couples than requested
+		CPPUNIT_ASSERT_EQUAL(size_t(4), weights.get(0, 10, false, result));
+	}
+
+	void batch_keeps_buffer_memory() {
+		weights_t weights(create_config(create_couples(4)), 2, false);
+
+		std::vector<groups_t> result;
+		CPPUNIT_ASSERT_EQUAL(size_t(4), weights.get(0, 4, true, result));
+		const auto *last_groups = result.back().data();
+
+		// Entries past the selected couples are left in place
+		CPPUNIT_ASSERT_EQUAL(size_t(2), weights.get(0, 2, false, result));
+		CPPUNIT_ASSERT_EQUAL(size_t(4), result.size());
+		CPPUNIT_ASSERT(last_groups == result.back().data());
+	}
+
+	void sequence_follows_weights() {
+		weights_t weights(create_config(create_couples(3)
+					, {100, 200, 300}, {1000, 1000, 1000}), 2, false);
+
+		std::map<std::vector<group_t>, double> shares;
+		const size_t count = 60000;
+
+		for (size_t index = 0; index != count; ++index) {
+			shares[draw_sequence(weights)] += 1. / count;
+		}
+
+		// Every next couple is drawn by weight among the rest
+		CPPUNIT_ASSERT_EQUAL(size_t(6), shares.size());
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 6 * 2 / 5, (shares[{1, 3, 5}]), 0.01);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 6 * 3 / 5, (shares[{1, 5, 3}]), 0.01);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 3 * 1 / 4, (shares[{3, 1, 5}]), 0.01);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 3 * 3 / 4, (shares[{3, 5, 1}]), 0.01);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 2 * 1 / 3, (shares[{5, 1, 3}]), 0.01);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 2 * 2 / 3, (shares[{5, 3, 1}]), 0.01);
+	}
+
+	void sequence_avoids_shared_hosts() {
+		weights_t weights(create_config(create_couples(3)
+					, {100, 200, 300}, {1000, 1000, 1000}), 2, false);
+
+		// The first two couples share host 0
+		std::vector<std::vector<size_t>> couples_hosts = {{0, 1}, {0, 2}, {3, 4}};
+		auto weighted_couples_info = weights.get_all(0);
+		auto hosts = std::make_shared<couple_sequence_init_t::data_t::hosts_t>();
+
+		for (auto it = weighted_couples_info.begin(), end = weighted_couples_info.end();
+				it != end; ++it) {
+			hosts->push_back(&couples_hosts[it->index]);
+		}
+
+		std::map<std::vector<group_t>, double> shares;
+		const size_t count = 60000;
+
+		for (size_t index = 0; index != count; ++index) {
+			shares[draw_sequence(weights, hosts)] += 1. / count;
+		}
+
+		// A couple on the shared host comes only after the couple on the other host
+		CPPUNIT_ASSERT_EQUAL(size_t(4), shares.size());
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 6, (shares[{1, 5, 3}]), 0.01);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 3, (shares[{3, 5, 1}]), 0.01);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 2 * 1 / 3, (shares[{5, 1, 3}]), 0.01);
+		CPPUNIT_ASSERT_DOUBLES_EQUAL(1. / 2 * 2 / 3, (shares[{5, 3, 1}]), 0.01);
+	}
+
+	void plan_has_part_for_every_part_size() {
+		weights_t weights(create_config(create_couples(3)
+					, {100, 100, 100}, {100000, 100000, 100000}), 2, false);
+
+		CPPUNIT_ASSERT_EQUAL(size_t(10), weights.plan(1000, 100).size());
+		CPPUNIT_ASSERT_EQUAL(size_t(11), weights.plan(1050, 100).size());
+		CPPUNIT_ASSERT_EQUAL(size_t(1), weights.plan(1000, 0).size());
+		CPPUNIT_ASSERT(weights.plan(0, 100).empty());
+	}
+
+	void plan_spreads_parts_by_weight() {
+		weights_t weights(create_config(create_couples(3)
+					, {100, 200, 300}, {100000, 100000, 100000}), 2, false);
+
+		// Shares of 10 parts are 1.67, 3.33 and 5
+		for (size_t attempt = 0; attempt != 100; ++attempt) {
+			auto counts = count_parts(weights.plan(1000, 100));
+
+			CPPUNIT_ASSERT(counts[1] == 1 || counts[1] == 2);
+			CPPUNIT_ASSERT(counts[3] == 3 || counts[3] == 4);
+			CPPUNIT_ASSERT_EQUAL(size_t(5), counts[5]);
+		}
+	}
+
+	void plan_keeps_parts_within_memory() {
+		// The first couple holds 10 parts of its share of 13.5
+		weights_t weights(create_config(create_couples(2)
+					, {900, 100}, {1000, 100000}), 2, false);
+
+		for (size_t attempt = 0; attempt != 100; ++attempt) {
+			auto counts = count_parts(weights.plan(1500, 100));
+
+			CPPUNIT_ASSERT_EQUAL(size_t(10), counts[1]);
+			CPPUNIT_ASSERT_EQUAL(size_t(5), counts[3]);
+		}
+
+		// Reserved bytes are not counted as free memory
+		weights.reserve(1, 500);
+		auto counts = count_parts(weights.plan(1500, 100));
+		CPPUNIT_ASSERT_EQUAL(size_t(5), counts[1]);
+		CPPUNIT_ASSERT_EQUAL(size_t(10), counts[3]);
+	}
+
+	void plan_throws_without_memory() {
+		weights_t weights(create_config(create_couples(2)), 2, false);
+
+		CPPUNIT_ASSERT_EQUAL(size_t(20), weights.plan(2000, 100).size());
+		CPPUNIT_ASSERT_THROW(weights.plan(2100, 100), not_enough_memory_error);
+	}
+
+	void plan_rounding_keeps_last_couple_within_memory() {
+		// Offsets of parts are the closest to 1 and round up to whole numbers
+		set_random_generator_factory([] (uint64_t) {
+			return random_generator_ptr_t(new max_random_generator_t);
+		});
+
+		// The last couple holds one part of its share of 1.5
+		weights_t weights(create_config(create_couples(2)
+					, {100, 100}, {100000, 100}), 2, false);
+
+		auto counts = count_parts(weights.plan(300, 100));
+
+		CPPUNIT_ASSERT_EQUAL(size_t(2), counts[1]);
+		CPPUNIT_ASSERT_EQUAL(size_t(1), counts[3]);
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(couple_weights_tests_t);
+
+int main() {
+	CppUnit::TextUi::TestRunner runner;
+	runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+	return runner.run() ? 0 : 1;
+}